@@ -0,0 +1,578 @@
+#include "engine.h"
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Max number of samples kept for the curves of a single game. When the buffer
+// is full every other sample is dropped, so a game never uses more memory than
+// this no matter how long it is.
+#define CURVE_SIZE 128
+// Max number of worker threads.
+#define MAX_JOBS 64
+
+// A point in the score/holes curves, taken every time a tetromino locks.
+typedef struct {
+    long time;
+    int score;
+    int holes;
+} CurveSample;
+
+// The statistics of a single replay.
+typedef struct {
+    char path[PATH_MAX];
+    // Time of the last event in microseconds.
+    long duration;
+    int pieces;
+    // Number of clears by type, index 1 is a single up to 4 for a tetris.
+    // Index 0 counts the locks that cleared nothing.
+    int clears[TETROMINO_BLOCK_SIZE + 1];
+    int lines;
+    int score;
+    int level;
+    int max_combo;
+    int back_to_backs;
+    int holes;
+    int max_holes;
+    // How the game ended: "lock-out", "block-out", "quit" or "incomplete".
+    const char *top_out;
+    // Set when the replay could not be read or is malformed, the game is left
+    // out of the output and the aggregate.
+    int is_error;
+
+    CurveSample curve[CURVE_SIZE];
+    int curve_size;
+    // Only every curve_stride-th lock is sampled.
+    int curve_stride;
+    int locks;
+} GameStats;
+
+// Output formats of the analyzer.
+enum Format {
+    FORMAT_CSV,
+    FORMAT_CURVES,
+    FORMAT_JSON,
+};
+
+// Running totals of the games printed so far, this is all that is kept once a
+// game has been printed.
+typedef struct {
+    int games;
+    int errors;
+    long duration;
+    int pieces;
+    int clears[TETROMINO_BLOCK_SIZE + 1];
+    int lines;
+    int max_combo;
+    int back_to_backs;
+    int score;
+    int level;
+    int holes;
+    int max_holes;
+    int lock_outs;
+    int block_outs;
+    int quits;
+} Totals;
+
+// The work shared by the worker threads. Each worker reads the next file from
+// the directory until there are none left, and prints each game as soon as it
+// is analyzed.
+typedef struct {
+    const char *dir_path;
+    // Guards the directory stream.
+    DIR *dir;
+    pthread_mutex_t mutex;
+
+    enum Format format;
+    // Guards the totals and stdout, so the games are printed whole.
+    Totals totals;
+    pthread_mutex_t output_mutex;
+} WorkQueue;
+
+// Counts the empty cells that have a block somewhere above them.
+int count_holes(int **grid) {
+    int holes = 0;
+    for (int x = 0; x < WIDTH; x++) {
+        int has_block_above = 0;
+        for (int y = 0; y < HEIGHT; y++) {
+            if (grid[y][x] == 1) {
+                has_block_above = 1;
+            } else if (has_block_above) {
+                holes++;
+            }
+        }
+    }
+    return holes;
+}
+
+// Adds a sample to the curve, halving the curve resolution when it is full.
+void add_curve_sample(GameStats *stats, long time) {
+    if (stats->locks++ % stats->curve_stride != 0) {
+        return;
+    }
+    if (stats->curve_size == CURVE_SIZE) {
+        for (int i = 0; i < CURVE_SIZE / 2; i++) {
+            stats->curve[i] = stats->curve[i * 2];
+        }
+        stats->curve_size = CURVE_SIZE / 2;
+        stats->curve_stride *= 2;
+        // the current lock may not fall on the new stride.
+        if ((stats->locks - 1) % stats->curve_stride != 0) {
+            return;
+        }
+    }
+    stats->curve[stats->curve_size].time = time;
+    stats->curve[stats->curve_size].score = stats->score;
+    stats->curve[stats->curve_size].holes = stats->holes;
+    stats->curve_size++;
+}
+
+// Replays a single file through the engine and fills its statistics.
+// Returns 0 on success, 1 if the file cannot be read or has a malformed event.
+int analyze_replay(GameStats *stats) {
+    GameState game_state;
+    char line[64], event, arg;
+    long time;
+    int has_tetromino = 0, line_number = 0, error = 0;
+
+    stats->top_out = "incomplete";
+    stats->curve_stride = 1;
+    stats->level = 1;
+
+    FILE *replay = fopen(stats->path, "r");
+    if (replay == NULL) {
+        perror(stats->path);
+        return 1;
+    }
+    if (init_game_state(&game_state, NULL) != 0) {
+        perror("pthread_mutex_init");
+        fclose(replay);
+        return 1;
+    }
+
+    while (!game_state.is_game_over && fgets(line, sizeof(line), replay)) {
+        line_number++;
+        arg = 0;
+        if (sscanf(line, "%ld %c %c", &time, &event, &arg) < 2) {
+            fprintf(stderr, "%s:%d: malformed event\n", stats->path,
+                    line_number);
+            error = 1;
+            break;
+        }
+        stats->duration = time;
+
+        if (event == REPLAY_SPAWN) {
+            char *shape = memchr(shape_names, arg, sizeof(shape_names));
+            if (shape == NULL) {
+                fprintf(stderr, "%s:%d: unknown shape\n", stats->path,
+                        line_number);
+                error = 1;
+                break;
+            }
+            spawn_tetromino(&game_state, shape - shape_names);
+            has_tetromino = 1;
+            stats->pieces++;
+            // same as update(), the game ends on a spawn over locked blocks.
+            if (detect_block_out(&game_state)) {
+                game_state.is_game_over = 1;
+                stats->top_out = "block-out";
+            }
+            continue;
+        }
+        if (event == REPLAY_QUIT) {
+            stats->top_out = "quit";
+            break;
+        }
+        // moves before the first tetromino cannot happen in a real game.
+        if (!has_tetromino) {
+            continue;
+        }
+
+        switch (event) {
+        case REPLAY_LEFT:
+            shift_points_left(&game_state);
+            break;
+        case REPLAY_RIGHT:
+            shift_points_right(&game_state);
+            break;
+        case REPLAY_ROTATE:
+            if (game_state.current_shape != O) {
+                rotate_tetromino_in_grid(&game_state);
+            }
+            break;
+        case REPLAY_SOFT_DROP:
+            soft_drop(&game_state);
+            break;
+        case REPLAY_GRAVITY:
+            shift_points_down(&game_state);
+            break;
+        case REPLAY_LOCK:
+            // same as update(), but driven by the recorded events.
+            if (is_game_over(&game_state)) {
+                game_state.is_game_over = 1;
+                stats->top_out = "lock-out";
+                break;
+            }
+            merge_tetromino_with_grid(&game_state);
+            ClearEvent clear =
+                score_clear(&game_state, clear_full_rows(&game_state));
+            stats->clears[clear.lines]++;
+            stats->lines += clear.lines;
+            if (clear.combo > stats->max_combo) {
+                stats->max_combo = clear.combo;
+            }
+            stats->back_to_backs += clear.is_back_to_back;
+            stats->level = game_state.level;
+            stats->score = game_state.score;
+            stats->holes = count_holes(game_state.virtual_grid);
+            if (stats->holes > stats->max_holes) {
+                stats->max_holes = stats->holes;
+            }
+            add_curve_sample(stats, time);
+            has_tetromino = 0;
+            break;
+        default:
+            break;
+        }
+        stats->score = game_state.score;
+    }
+
+    if (ferror(replay)) {
+        perror(stats->path);
+        error = 1;
+    }
+    free_game_state(&game_state);
+    fclose(replay);
+    return error;
+}
+
+// Pieces per second of a game, 0 if it has no duration.
+double pieces_per_second(int pieces, long duration) {
+    if (duration <= 0) {
+        return 0;
+    }
+    return pieces / ((double)duration / ONE_SECOND_IN_MS);
+}
+
+// Prints a string as a JSON string, control characters are escaped.
+void print_json_string(const char *s) {
+    putchar('"');
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') {
+            printf("\\%c", c);
+        } else if (c == '\n') {
+            printf("\\n");
+        } else if (c == '\r') {
+            printf("\\r");
+        } else if (c == '\t') {
+            printf("\\t");
+        } else if (c < 0x20) {
+            printf("\\u%04x", c);
+        } else {
+            putchar(c);
+        }
+    }
+    putchar('"');
+}
+
+// Prints a string as a CSV field, quoted when it has a comma, a quote or a
+// line break, with the quotes doubled.
+void print_csv_string(const char *s) {
+    if (strpbrk(s, ",\"\r\n") == NULL) {
+        fputs(s, stdout);
+        return;
+    }
+    putchar('"');
+    for (; *s; s++) {
+        if (*s == '"') {
+            putchar('"');
+        }
+        putchar(*s);
+    }
+    putchar('"');
+}
+
+// Prints the CSV header.
+void print_csv_header() {
+    printf("file,duration_s,pieces,pps,singles,doubles,triples,tetrises,lines,"
+           "max_combo,back_to_backs,score,level,holes,max_holes,top_out\n");
+}
+
+// Prints the CSV line of a game.
+void print_csv_game(GameStats *game) {
+    print_csv_string(game->path);
+    printf(",%.3f,%d,%.3f,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%s\n",
+           (double)game->duration / ONE_SECOND_IN_MS, game->pieces,
+           pieces_per_second(game->pieces, game->duration), game->clears[1],
+           game->clears[2], game->clears[3], game->clears[4], game->lines,
+           game->max_combo, game->back_to_backs, game->score, game->level,
+           game->holes, game->max_holes, game->top_out);
+}
+
+// Prints the CSV line with the aggregate.
+void print_csv_totals(Totals *totals) {
+    printf("TOTAL,%.3f,%d,%.3f,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,\n",
+           (double)totals->duration / ONE_SECOND_IN_MS, totals->pieces,
+           pieces_per_second(totals->pieces, totals->duration),
+           totals->clears[1], totals->clears[2], totals->clears[3],
+           totals->clears[4], totals->lines, totals->max_combo,
+           totals->back_to_backs, totals->score, totals->level, totals->holes,
+           totals->max_holes);
+}
+
+// Prints the score and holes curves of a game, one line per sample.
+void print_curves_game(GameStats *game) {
+    for (int s = 0; s < game->curve_size; s++) {
+        CurveSample *sample = &game->curve[s];
+        print_csv_string(game->path);
+        printf(",%.3f,%d,%d\n", (double)sample->time / ONE_SECOND_IN_MS,
+               sample->score, sample->holes);
+    }
+}
+
+// Prints a game with its curve as a JSON object, preceded by a comma unless it
+// is the first one.
+void print_json_game(GameStats *game, int is_first) {
+    printf("%s{\"file\":", is_first ? "" : ",");
+    print_json_string(game->path);
+    printf(",\"duration_s\":%.3f,\"pieces\":%d,\"pps\":%.3f,"
+           "\"clears\":{\"single\":%d,\"double\":%d,\"triple\":%d,"
+           "\"tetris\":%d},\"lines\":%d,\"max_combo\":%d,"
+           "\"back_to_backs\":%d,\"score\":%d,\"level\":%d,"
+           "\"holes\":%d,\"max_holes\":%d,\"top_out\":\"%s\","
+           "\"curve\":[",
+           (double)game->duration / ONE_SECOND_IN_MS, game->pieces,
+           pieces_per_second(game->pieces, game->duration), game->clears[1],
+           game->clears[2], game->clears[3], game->clears[4], game->lines,
+           game->max_combo, game->back_to_backs, game->score, game->level,
+           game->holes, game->max_holes, game->top_out);
+    for (int s = 0; s < game->curve_size; s++) {
+        printf("%s{\"time_s\":%.3f,\"score\":%d,\"holes\":%d}",
+               s > 0 ? "," : "", (double)game->curve[s].time / ONE_SECOND_IN_MS,
+               game->curve[s].score, game->curve[s].holes);
+    }
+    printf("]}");
+}
+
+// Closes the games array and prints the aggregate.
+void print_json_totals(Totals *totals) {
+    printf("],\"total\":{\"games\":%d,\"errors\":%d,\"duration_s\":%.3f,"
+           "\"pieces\":%d,\"pps\":%.3f,\"clears\":{\"single\":%d,"
+           "\"double\":%d,\"triple\":%d,\"tetris\":%d},\"lines\":%d,"
+           "\"max_combo\":%d,\"back_to_backs\":%d,\"score\":%d,"
+           "\"level\":%d,\"holes\":%d,\"max_holes\":%d,"
+           "\"top_out\":{\"lock-out\":%d,\"block-out\":%d,\"quit\":%d,"
+           "\"incomplete\":%d}}}\n",
+           totals->games, totals->errors,
+           (double)totals->duration / ONE_SECOND_IN_MS, totals->pieces,
+           pieces_per_second(totals->pieces, totals->duration),
+           totals->clears[1], totals->clears[2], totals->clears[3],
+           totals->clears[4], totals->lines, totals->max_combo,
+           totals->back_to_backs, totals->score, totals->level, totals->holes,
+           totals->max_holes, totals->lock_outs, totals->block_outs,
+           totals->quits,
+           totals->games - totals->lock_outs - totals->block_outs -
+               totals->quits);
+}
+
+// Adds a game to the running totals.
+void add_to_totals(Totals *totals, GameStats *game) {
+    totals->games++;
+    totals->duration += game->duration;
+    totals->pieces += game->pieces;
+    for (int c = 1; c <= TETROMINO_BLOCK_SIZE; c++) {
+        totals->clears[c] += game->clears[c];
+    }
+    totals->lines += game->lines;
+    if (game->max_combo > totals->max_combo) {
+        totals->max_combo = game->max_combo;
+    }
+    totals->back_to_backs += game->back_to_backs;
+    totals->score += game->score;
+    if (game->level > totals->level) {
+        totals->level = game->level;
+    }
+    totals->holes += game->holes;
+    if (game->max_holes > totals->max_holes) {
+        totals->max_holes = game->max_holes;
+    }
+    totals->lock_outs += strcmp(game->top_out, "lock-out") == 0;
+    totals->block_outs += strcmp(game->top_out, "block-out") == 0;
+    totals->quits += strcmp(game->top_out, "quit") == 0;
+}
+
+// Prints a game that was just analyzed and adds it to the totals. Games that
+// failed are only counted.
+void report_game(WorkQueue *queue, GameStats *game) {
+    pthread_mutex_lock(&queue->output_mutex);
+    if (game->is_error) {
+        queue->totals.errors++;
+        pthread_mutex_unlock(&queue->output_mutex);
+        return;
+    }
+    switch (queue->format) {
+    case FORMAT_CSV:
+        print_csv_game(game);
+        break;
+    case FORMAT_CURVES:
+        print_curves_game(game);
+        break;
+    case FORMAT_JSON:
+        print_json_game(game, queue->totals.games == 0);
+        break;
+    }
+    add_to_totals(&queue->totals, game);
+    fflush(stdout);
+    pthread_mutex_unlock(&queue->output_mutex);
+}
+
+// Takes the next regular file from the directory and resets the statistics
+// for it. Returns 0 when there are no files left.
+int next_replay(WorkQueue *queue, GameStats *game) {
+    struct dirent *entry;
+    struct stat st;
+    int found = 0;
+
+    pthread_mutex_lock(&queue->mutex);
+    while (!found && (entry = readdir(queue->dir)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        memset(game, 0, sizeof(GameStats));
+        snprintf(game->path, sizeof(game->path), "%s/%s", queue->dir_path,
+                 entry->d_name);
+        found = stat(game->path, &st) == 0 && S_ISREG(st.st_mode);
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    return found;
+}
+
+// This is a thread function that analyzes replays until the directory has
+// none left. Each worker has a single game in flight, so the memory used does
+// not depend on the number of replays.
+void *analyze_worker(void *arg) {
+    WorkQueue *queue = (WorkQueue *)arg;
+    GameStats *game = malloc(sizeof(GameStats));
+    if (game == NULL) {
+        perror("malloc");
+        return NULL;
+    }
+    while (next_replay(queue, game)) {
+        game->is_error = analyze_replay(game) != 0;
+        report_game(queue, game);
+    }
+    free(game);
+    return NULL;
+}
+
+void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-j jobs] [-f csv|curves|json] <replay-dir>\n",
+            name);
+}
+
+// Usage: tetris-analyze [-j jobs] [-f csv|curves|json] <replay-dir>
+// Streams every replay in the directory through the engine, one file per
+// worker at a time, and prints the statistics of each game as soon as it is
+// done. Games are printed in the order they finish.
+int main(int argc, char **argv) {
+    pthread_t threads[MAX_JOBS];
+    WorkQueue queue;
+    int jobs = sysconf(_SC_NPROCESSORS_ONLN), opt;
+
+    memset(&queue, 0, sizeof(queue));
+    queue.format = FORMAT_CSV;
+    while ((opt = getopt(argc, argv, "j:f:")) != -1) {
+        switch (opt) {
+        case 'j':
+            jobs = atoi(optarg);
+            break;
+        case 'f':
+            if (strcmp(optarg, "csv") == 0) {
+                queue.format = FORMAT_CSV;
+            } else if (strcmp(optarg, "curves") == 0) {
+                queue.format = FORMAT_CURVES;
+            } else if (strcmp(optarg, "json") == 0) {
+                queue.format = FORMAT_JSON;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (jobs < 1) {
+        jobs = 1;
+    }
+    if (jobs > MAX_JOBS) {
+        jobs = MAX_JOBS;
+    }
+
+    queue.dir_path = argv[optind];
+    queue.dir = opendir(queue.dir_path);
+    if (queue.dir == NULL) {
+        perror(queue.dir_path);
+        return 1;
+    }
+    if (pthread_mutex_init(&queue.mutex, NULL) != 0 ||
+        pthread_mutex_init(&queue.output_mutex, NULL) != 0) {
+        perror("pthread_mutex_init");
+        closedir(queue.dir);
+        return 1;
+    }
+
+    switch (queue.format) {
+    case FORMAT_CSV:
+        print_csv_header();
+        break;
+    case FORMAT_CURVES:
+        printf("file,time_s,score,holes\n");
+        break;
+    case FORMAT_JSON:
+        printf("{\"games\":[");
+        break;
+    }
+
+    for (int i = 0; i < jobs; i++) {
+        if (pthread_create(&threads[i], NULL, analyze_worker, &queue) != 0) {
+            perror("pthread_create");
+            jobs = i;
+            break;
+        }
+    }
+    // pick up whatever is left if no thread could be started.
+    if (jobs == 0) {
+        analyze_worker(&queue);
+    }
+    for (int i = 0; i < jobs; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_mutex_destroy(&queue.output_mutex);
+    pthread_mutex_destroy(&queue.mutex);
+    closedir(queue.dir);
+
+    if (queue.format == FORMAT_CSV) {
+        print_csv_totals(&queue.totals);
+    } else if (queue.format == FORMAT_JSON) {
+        print_json_totals(&queue.totals);
+    }
+
+    if (queue.totals.errors > 0) {
+        fprintf(stderr, "%s: %d of %d replays could not be analyzed\n",
+                argv[0], queue.totals.errors,
+                queue.totals.games + queue.totals.errors);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,634 @@
+#include "engine.h"
+#include "metrics.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+char shape_names[7] = {'I', 'O', 'T', 'S', 'Z', 'J', 'L'};
+
+// Gets the current time in miliseconds. The function uses the system time to
+// calculate the current time.
+long get_current_time() {
+    struct timeval current_time;
+    gettimeofday(&current_time, NULL);
+    return (current_time.tv_sec * ONE_SECOND_IN_MS + current_time.tv_usec);
+}
+
+// Initialize the playfield and the timers of the game state. The replay file
+// can be NULL if the game should not be recorded. Returns 0 on success.
+int init_game_state(GameState *game_state, FILE *replay) {
+    // recursive so a whole update or input action can hold the lock while
+    // the functions it calls take it again.
+    pthread_mutexattr_t mutex_attr;
+    pthread_mutexattr_init(&mutex_attr);
+    pthread_mutexattr_settype(&mutex_attr, PTHREAD_MUTEX_RECURSIVE);
+    int error = pthread_mutex_init(&game_state->mutex, &mutex_attr);
+    pthread_mutexattr_destroy(&mutex_attr);
+    if (error != 0) {
+        return 1;
+    }
+
+    // init the points array
+    game_state->points = (Point *)malloc(TETROMINO_BLOCK_SIZE * sizeof(Point));
+
+    game_state->virtual_grid = (int **)malloc(HEIGHT * sizeof(int *));
+    game_state->row_fill = (int *)malloc(HEIGHT * sizeof(int));
+    for (int y = 0; y < HEIGHT; y++) {
+        game_state->virtual_grid[y] = (int *)malloc(WIDTH * sizeof(int));
+        for (int x = 0; x < WIDTH; x++) {
+            game_state->virtual_grid[y][x] = 0;
+        }
+        game_state->row_fill[y] = 0;
+    }
+
+    game_state->current_time = 0;
+    game_state->last_view_update_time = 0;
+    game_state->last_gravity_update_time = 0;
+    game_state->last_virtual_grid_update_time = 0;
+
+    game_state->score = 0;
+    game_state->lines = 0;
+    game_state->level = 1;
+    game_state->combo = -1;
+    game_state->is_back_to_back = 0;
+
+    game_state->is_game_over = 0;
+
+    game_state->replay = replay;
+    game_state->start_time = get_current_time();
+    return 0;
+}
+
+// Frees everything allocated by init_game_state.
+void free_game_state(GameState *game_state) {
+    for (int y = 0; y < HEIGHT; y++) {
+        free(game_state->virtual_grid[y]);
+    }
+    free(game_state->virtual_grid);
+    free(game_state->row_fill);
+    free(game_state->points);
+    pthread_mutex_destroy(&game_state->mutex);
+}
+
+// Writes an event to the replay file if the game is being recorded. The arg
+// is optional, pass 0 when the event has none.
+void record_event(GameState *game_state, char event, char arg) {
+    if (game_state->replay == NULL) {
+        return;
+    }
+    long t = get_current_time() - game_state->start_time;
+    if (arg) {
+        fprintf(game_state->replay, "%ld %c %c\n", t, event, arg);
+    } else {
+        fprintf(game_state->replay, "%ld %c\n", t, event);
+    }
+}
+
+// Correct any point(s) that are out of bounds after rotation. Each opposite
+// side are exclusive to each other.
+void correct_points_after_rotation(Point *points) {
+    int min_x = 0, min_y = 0, max_x = WIDTH - 1, max_y = HEIGHT - 1,
+        shift_x = 0, shift_y = 0;
+
+    // each opposite side its actually mutually exclusive so they won't
+    // interfere with the final shift amount.
+    for (int i = 0; i < TETROMINO_BLOCK_SIZE; i++) {
+        // left side
+        if (points[i].x < min_x)
+            min_x = points[i].x;
+        // right side
+        if (points[i].x > max_x)
+            max_x = points[i].x;
+
+        // top side
+        if (points[i].y < min_y)
+            min_y = points[i].y;
+        // bottom side
+        if (points[i].y > max_y)
+            max_y = points[i].y;
+    }
+
+    if (min_x < 0)
+        // shift right, change sign, negative to positive with double negative
+        shift_x = -min_x;
+    if (min_y < 0)
+        // shift down, change sign, negative to positive with double negative
+        shift_y = -min_y;
+    if (max_x >= WIDTH)
+        // shift left
+        shift_x = WIDTH - 1 - max_x;
+    if (max_y >= HEIGHT)
+        // shift up
+        shift_y = HEIGHT - 1 - max_y;
+
+    for (int i = 0; i < TETROMINO_BLOCK_SIZE; i++) {
+        points[i].x += shift_x;
+        points[i].y += shift_y;
+    }
+}
+
+// Rotate the currently manipulated tetromino in the grid clockwise. The
+// rotation is undone if it would overlap the blocks already in the grid, the
+// row fill counts rely on a tetromino never covering another block.
+void rotate_tetromino_in_grid(GameState *game_state) {
+    Point *points = game_state->points;
+    Point pivot = points[2], original[TETROMINO_BLOCK_SIZE];
+    int x, y, rotated_x, rotated_y;
+    pthread_mutex_lock(&game_state->mutex);
+    memcpy(original, points, sizeof(original));
+    for (int i = 0; i < TETROMINO_BLOCK_SIZE; i++) {
+        x = points[i].x - pivot.x;
+        y = points[i].y - pivot.y;
+        rotated_x = y + pivot.x;
+        rotated_y = -x + pivot.y;
+        points[i].x = rotated_x;
+        points[i].y = rotated_y;
+    }
+
+    // correct the points if out of bounce
+    correct_points_after_rotation(points);
+
+    for (int i = 0; i < TETROMINO_BLOCK_SIZE; i++) {
+        if (game_state->virtual_grid[points[i].y][points[i].x] == 1) {
+            memcpy(points, original, sizeof(original));
+            break;
+        }
+    }
+    pthread_mutex_unlock(&game_state->mutex);
+}
+
+// Clears the tetromino described by the points on the grid.
+void clear_tetromino_in_grid(GameState *game_state) {
+    int **grid = game_state->virtual_grid;
+    Point *points = game_state->points;
+    int x, y;
+    pthread_mutex_lock(&game_state->mutex);
+    for (int i = 0; i < TETROMINO_BLOCK_SIZE; i++) {
+        x = points[i].x, y = points[i].y;
+        grid[y][x] = 0;
+    }
+    pthread_mutex_unlock(&game_state->mutex);
+}
+
+// Places the tetromino described by the points on the grid.
+void place_tetromino_in_grid(GameState *game_state) {
+    int **grid = game_state->virtual_grid;
+    Point *points = game_state->points;
+    int x, y;
+    pthread_mutex_lock(&game_state->mutex);
+    for (int i = 0; i < TETROMINO_BLOCK_SIZE; i++) {
+        x = points[i].x, y = points[i].y;
+        grid[y][x] = 1;
+    }
+    pthread_mutex_unlock(&game_state->mutex);
+}
+
+// Send the current tetromino immmediately down.
+// void instant_fall(GameState *game_state) {
+//     Point lowest_point = {0, 0};
+//     int max_y = 0, shift_y = 0;
+//     // find the lowest point of the tetromino
+//     for (int i = 0; i < TETROMINO_BLOCK_SIZE; i++) {
+//         if (game_state->points[i].y > lowest_point.y)
+//             lowest_point = game_state->points[i];
+//     }
+//     // find the shift amount from lowest point to bottom
+//     for (int y = lowest_point.y; y < HEIGHT; y++) {
+//         if (game_state->virtual_grid[y][lowest_point.x] == 0) {
+//             shift_y += 1;
+//         } else {
+//             break;
+//         }
+//     }
+//     // shift the tetromino points
+//     for (int i = 0; i < TETROMINO_BLOCK_SIZE; i++) {
+//         game_state->points[i].y += shift_y;
+//         if (game_state->points[i].y >= HEIGHT) {
+//             game_state->points[i].y = HEIGHT - 1;
+//         }
+//     }
+// }
+
+// Sets the default starting points of the given tetromino in the game state.
+void spawn_tetromino(GameState *game_state, enum Tetromino t) {
+    pthread_mutex_lock(&game_state->mutex);
+    switch (t) {
+    case I:
+        // Shape
+        // [][][][]
+        for (int i = 0; i < TETROMINO_BLOCK_SIZE; i++) {
+            game_state->points[i].y = 0;
+            game_state->points[i].x = WIDTH / 2 + i - 2;
+        }
+        break;
+    case T:
+        // Shape
+        //   []
+        // [][][]
+        // top middle point
+        game_state->points[0].y = 0;
+        game_state->points[0].x = WIDTH / 2 - 1;
+
+        // lower left point
+        game_state->points[1].y = 1;
+        game_state->points[1].x = WIDTH / 2 - 2;
+
+        // lower middle point
+        game_state->points[2].y = 1;
+        game_state->points[2].x = WIDTH / 2 - 1;
+
+        // lower right point
+        game_state->points[3].y = 1;
+        game_state->points[3].x = WIDTH / 2;
+        break;
+    case O:
+        // Shape
+        // [][]
+        // [][]
+        game_state->points[0].y = 0;
+        game_state->points[0].x = WIDTH / 2 - 1;
+
+        game_state->points[1].y = 0;
+        game_state->points[1].x = WIDTH / 2;
+
+        game_state->points[2].y = 1;
+        game_state->points[2].x = WIDTH / 2 - 1;
+
+        game_state->points[3].y = 1;
+        game_state->points[3].x = WIDTH / 2;
+        break;
+    case S:
+        // Shape
+        //   [][]
+        // [][]
+        // top middle point
+        game_state->points[0].y = 0;
+        game_state->points[0].x = WIDTH / 2 - 1;
+
+        // top right point
+        game_state->points[1].y = 0;
+        game_state->points[1].x = WIDTH / 2;
+
+        // lower middle point
+        game_state->points[2].y = 1;
+        game_state->points[2].x = WIDTH / 2 - 1;
+
+        // lower left point
+        game_state->points[3].y = 1;
+        game_state->points[3].x = WIDTH / 2 - 2;
+        break;
+    case Z:
+        // Shape
+        // [][]
+        //   [][]
+        // top left point
+        game_state->points[0].y = 0;
+        game_state->points[0].x = WIDTH / 2 - 1;
+
+        // top middle point
+        game_state->points[1].y = 0;
+        game_state->points[1].x = WIDTH / 2;
+
+        // lower middle point
+        game_state->points[2].y = 1;
+        game_state->points[2].x = WIDTH / 2;
+
+        // lower right point
+        game_state->points[3].y = 1;
+        game_state->points[3].x = WIDTH / 2 + 1;
+        break;
+    case L:
+        // Shape
+        //     []
+        // [][][]
+        // top right point
+        game_state->points[0].y = 0;
+        game_state->points[0].x = WIDTH / 2;
+
+        // lower left point
+        game_state->points[1].y = 1;
+        game_state->points[1].x = WIDTH / 2 - 2;
+
+        // lower middle point
+        game_state->points[2].y = 1;
+        game_state->points[2].x = WIDTH / 2 - 1;
+
+        // lower right point
+        game_state->points[3].y = 1;
+        game_state->points[3].x = WIDTH / 2;
+        break;
+    case J:
+        // Shape
+        // []
+        // [][][]
+        // top left point
+        game_state->points[0].y = 0;
+        game_state->points[0].x = WIDTH / 2 - 2;
+
+        // lower left point
+        game_state->points[1].y = 1;
+        game_state->points[1].x = WIDTH / 2 - 2;
+
+        // lower middle point
+        game_state->points[2].y = 1;
+        game_state->points[2].x = WIDTH / 2 - 1;
+
+        // lower right point
+        game_state->points[3].y = 1;
+        game_state->points[3].x = WIDTH / 2;
+        break;
+    }
+    pthread_mutex_unlock(&game_state->mutex);
+    game_state->current_shape = t;
+}
+
+// Randomly picks a tetromino and spawns it.
+void pick_tetromino(GameState *game_state) {
+    enum Tetromino t = rand() % 7;
+    spawn_tetromino(game_state, t);
+    metrics_add(METRIC_PIECES_SPAWNED, 1);
+    record_event(game_state, REPLAY_SPAWN, shape_names[t]);
+}
+
+// Checks if 100ms has passed since the last update.
+int can_update_virtual_grid(GameState *game_state) {
+    return game_state->last_virtual_grid_update_time == 0 ||
+           game_state->current_time -
+                   game_state->last_virtual_grid_update_time >=
+               MS_50;
+}
+
+// Time it takes a tetromino to fall by one block at the given level, in
+// microseconds. This is the guideline speed curve, scaled so level 1 keeps
+// the 500ms the game always had.
+long gravity_delay(int level) {
+    static const long delays[] = {
+        500000, 396500, 308898, 236364, 177600, 131001, 94838, 67367,
+        46941,  32075,  21488,  14108,  9076,   5719,   3529,
+    };
+    int max_level = sizeof(delays) / sizeof(delays[0]);
+    if (level > max_level) {
+        level = max_level;
+    }
+    return delays[level - 1];
+}
+
+// Checks if the gravity delay has passed since the last update.
+int can_update_gravity(GameState *game_state) {
+    return game_state->last_gravity_update_time == 0 ||
+           game_state->current_time - game_state->last_gravity_update_time >=
+               gravity_delay(game_state->level);
+}
+
+// Checks if the tetromino that just spawned overlaps blocks locked in the
+// grid, a block out that ends the game. This should only be called before the
+// tetromino is placed in the grid.
+int detect_block_out(GameState *game_state) {
+    for (int i = 0; i < TETROMINO_BLOCK_SIZE; i++) {
+        Point point = game_state->points[i];
+        if (game_state->virtual_grid[point.y][point.x] == 1) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Check if game is over or not, this should only be called when a bottom
+// collision happens.
+int is_game_over(GameState *game_state) {
+    for (int i = 0; i < TETROMINO_BLOCK_SIZE; i++) {
+        if (game_state->points[i].y - 1 < 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Collision detection on the bottom of the current points.
+int detect_collision_bottom(GameState *game_state) {
+    for (int i = 0; i < TETROMINO_BLOCK_SIZE; i++) {
+        int peek_y = game_state->points[i].y + 1;
+        if (peek_y >= HEIGHT ||
+            game_state->virtual_grid[peek_y][game_state->points[i].x] == 1) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Collision detection on the left of the current points.
+int detect_collision_left(GameState *game_state) {
+    for (int i = 0; i < TETROMINO_BLOCK_SIZE; i++) {
+        int peek_x = game_state->points[i].x - 1;
+        if (peek_x < 0 ||
+            game_state->virtual_grid[game_state->points[i].y][peek_x] == 1) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Collision detection on the right of the current points.
+int detect_collision_right(GameState *game_state) {
+    for (int i = 0; i < TETROMINO_BLOCK_SIZE; i++) {
+        int peek_x = game_state->points[i].x + 1;
+        if (peek_x >= WIDTH ||
+            game_state->virtual_grid[game_state->points[i].y][peek_x] == 1) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Shifts the current points 1 unit down if possible, otherwise it will stay the
+// same.
+void shift_points_down(GameState *game_state) {
+    if (detect_collision_bottom(game_state)) {
+        return;
+    }
+    pthread_mutex_lock(&game_state->mutex);
+    for (int i = 0; i < TETROMINO_BLOCK_SIZE; i++) {
+        game_state->points[i].y++;
+    }
+    pthread_mutex_unlock(&game_state->mutex);
+}
+
+// Shifts the current points 1 unit left if possible, otherwise it will stay the
+// same.
+void shift_points_left(GameState *game_state) {
+    if (detect_collision_left(game_state)) {
+        return;
+    }
+    pthread_mutex_lock(&game_state->mutex);
+    for (int i = 0; i < TETROMINO_BLOCK_SIZE; i++) {
+        game_state->points[i].x--;
+    }
+    pthread_mutex_unlock(&game_state->mutex);
+}
+
+// Shifts the current points 1 unit right if possible, otherwise it will stay
+// the same.
+void shift_points_right(GameState *game_state) {
+    if (detect_collision_right(game_state)) {
+        return;
+    }
+    pthread_mutex_lock(&game_state->mutex);
+    for (int i = 0; i < TETROMINO_BLOCK_SIZE; i++) {
+        game_state->points[i].x++;
+    }
+    pthread_mutex_unlock(&game_state->mutex);
+}
+
+// Merges the current manipulated tetromino into the grid and counts the new
+// blocks in the row fill counts.
+void merge_tetromino_with_grid(GameState *game_state) {
+    int x, y;
+    pthread_mutex_lock(&game_state->mutex);
+    for (int i = 0; i < TETROMINO_BLOCK_SIZE; i++) {
+        x = game_state->points[i].x, y = game_state->points[i].y;
+        if (game_state->virtual_grid[y][x] == 0) {
+            game_state->virtual_grid[y][x] = 1;
+            game_state->row_fill[y]++;
+        }
+    }
+    pthread_mutex_unlock(&game_state->mutex);
+}
+
+// Erases the completed rows. Only the rows the just merged tetromino touched
+// can be complete, so only those are checked, and all the rows are then moved
+// down in a single pass. Returns the number of rows cleared.
+int clear_full_rows(GameState *game_state) {
+    int **grid = game_state->virtual_grid;
+    int *row_fill = game_state->row_fill;
+    int *cleared_rows[TETROMINO_BLOCK_SIZE];
+    int cleared = 0, lowest_full_row = -1, y, write_y;
+
+    pthread_mutex_lock(&game_state->mutex);
+    for (int i = 0; i < TETROMINO_BLOCK_SIZE; i++) {
+        y = game_state->points[i].y;
+        if (row_fill[y] == WIDTH && y > lowest_full_row) {
+            lowest_full_row = y;
+        }
+    }
+    if (lowest_full_row == -1) {
+        pthread_mutex_unlock(&game_state->mutex);
+        return 0;
+    }
+
+    // the rows below the lowest full row stay where they are, the others are
+    // moved down over the full rows by swapping the row pointers.
+    write_y = lowest_full_row;
+    for (y = lowest_full_row; y >= 0; y--) {
+        if (row_fill[y] == WIDTH) {
+            cleared_rows[cleared++] = grid[y];
+        } else {
+            grid[write_y] = grid[y];
+            row_fill[write_y] = row_fill[y];
+            write_y--;
+        }
+    }
+    // the cleared rows are reused as the new empty rows on top.
+    for (int i = 0; i < cleared; i++) {
+        memset(cleared_rows[i], 0, WIDTH * sizeof(int));
+        grid[i] = cleared_rows[i];
+        row_fill[i] = 0;
+    }
+    pthread_mutex_unlock(&game_state->mutex);
+    return cleared;
+}
+
+// Scores a lock that cleared the given number of rows with the guideline
+// scoring: the clear points and the combo bonus are multiplied by the level,
+// and a tetris right after another tetris is worth half as much again. Every
+// lock has to go through here, even the ones clearing nothing, since they
+// break the combo.
+ClearEvent score_clear(GameState *game_state, int cleared) {
+    static const int clear_points[] = {0, 100, 300, 500, 800};
+    ClearEvent event = {cleared, -1, 0, 0};
+
+    if (cleared == 0) {
+        game_state->combo = -1;
+        return event;
+    }
+
+    game_state->combo++;
+    event.combo = game_state->combo;
+
+    event.points = clear_points[cleared] * game_state->level;
+    if (cleared == TETROMINO_BLOCK_SIZE) {
+        if (game_state->is_back_to_back) {
+            event.is_back_to_back = 1;
+            event.points += event.points / 2;
+        }
+        game_state->is_back_to_back = 1;
+    } else {
+        game_state->is_back_to_back = 0;
+    }
+    event.points += 50 * event.combo * game_state->level;
+
+    pthread_mutex_lock(&game_state->mutex);
+    game_state->score += event.points;
+    pthread_mutex_unlock(&game_state->mutex);
+
+    // a new level every 10 lines.
+    game_state->lines += cleared;
+    game_state->level = game_state->lines / 10 + 1;
+    return event;
+}
+
+// Moves the tetromino one unit down, a soft drop is worth 1 point per row.
+void soft_drop(GameState *game_state) {
+    if (detect_collision_bottom(game_state)) {
+        return;
+    }
+    shift_points_down(game_state);
+    pthread_mutex_lock(&game_state->mutex);
+    game_state->score += 1;
+    pthread_mutex_unlock(&game_state->mutex);
+}
+
+// Update the virtual grid according to various states. The whole update holds
+// the game lock so input actions cannot interleave with it, otherwise the
+// replay events would not be recorded in the order they happened.
+int update(GameState *game_state) {
+    metrics_add(METRIC_TICKS, 1);
+    pthread_mutex_lock(&game_state->mutex);
+
+    if (can_update_virtual_grid(game_state)) {
+        clear_tetromino_in_grid(game_state);
+    }
+
+    if (can_update_virtual_grid(game_state) &&
+        detect_collision_bottom(game_state)) {
+        record_event(game_state, REPLAY_LOCK, 0);
+        if (is_game_over(game_state)) {
+            game_state->is_game_over = 1;
+        } else {
+            merge_tetromino_with_grid(game_state);
+            ClearEvent event =
+                score_clear(game_state, clear_full_rows(game_state));
+            metrics_add(METRIC_LINES_CLEARED, event.lines);
+            pick_tetromino(game_state);
+            // placing it would overwrite the blocks it overlaps.
+            if (detect_block_out(game_state)) {
+                game_state->is_game_over = 1;
+            }
+        }
+    } else if (can_update_gravity(game_state)) {
+        game_state->last_gravity_update_time = game_state->current_time;
+        // the tetromino may still be in the grid, take it out so it does not
+        // collide with itself.
+        clear_tetromino_in_grid(game_state);
+        shift_points_down(game_state);
+        place_tetromino_in_grid(game_state);
+        record_event(game_state, REPLAY_GRAVITY, 0);
+    }
+
+    if (!game_state->is_game_over && can_update_virtual_grid(game_state)) {
+        game_state->last_virtual_grid_update_time = game_state->current_time;
+        place_tetromino_in_grid(game_state);
+    }
+
+    pthread_mutex_unlock(&game_state->mutex);
+    return 0;
+}
@@ -0,0 +1,160 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <pthread.h>
+#include <stdio.h>
+
+#define HEIGHT 16
+#define WIDTH 10
+#define ONE_SECOND_IN_MS 1000000
+// Delay in microseconds (50 ms)
+#define MS_50 50000
+// Delay in microseconds (100 ms)
+#define MS_100 100000
+// Delay in microseconds (150 ms)
+#define MS_150 150000
+// Delay in microseconds (200 ms)
+#define MS_200 200000
+// Delay in microseconds (500 ms)
+#define MS_500 500000
+// Each tetromino can be represented by 4 points. This is the size of the array
+// containing those points.
+#define TETROMINO_BLOCK_SIZE 4
+
+// Replay events. Each line of a replay file is "<time> <event>[ <arg>]", where
+// time is in microseconds since the game started.
+// A new tetromino was spawned, the argument is the shape name. The game ends
+// right there if it overlaps locked blocks (block out).
+#define REPLAY_SPAWN 'P'
+// The tetromino moved one unit left.
+#define REPLAY_LEFT 'L'
+// The tetromino moved one unit right.
+#define REPLAY_RIGHT 'R'
+// The tetromino was rotated clockwise.
+#define REPLAY_ROTATE 'U'
+// The tetromino moved one unit down because of a soft drop.
+#define REPLAY_SOFT_DROP 'D'
+// The tetromino fell one unit because of gravity.
+#define REPLAY_GRAVITY 'G'
+// The tetromino touched the bottom and got locked (or locked out).
+#define REPLAY_LOCK 'K'
+// The player quit the game.
+#define REPLAY_QUIT 'Q'
+
+// This represents the different tetromino available.
+enum Tetromino {
+    I,
+    O,
+    T,
+    S,
+    Z,
+    J,
+    L,
+};
+
+// Represents an individual point/block that makes up a tetromino.
+typedef struct {
+    int x, y;
+} Point;
+
+// What a lock cleared and what it was worth.
+typedef struct {
+    // Rows cleared: 1 is a single, 2 a double, 3 a triple and 4 a tetris.
+    int lines;
+    // How many clears in a row came before this one, -1 when nothing was
+    // cleared.
+    int combo;
+    // Set when this tetris came right after another tetris.
+    int is_back_to_back;
+    int points;
+} ClearEvent;
+
+// A game state. Everything the game needs will be here.
+typedef struct {
+    // A virtual grid to represent the state of the playfield.
+    // This makes it easier to do collision detection, rotation and movement.
+    // Then when everything has been checked, the grid can be printed.
+    int **virtual_grid;
+    // Number of blocks merged in each row of the virtual grid. The current
+    // tetromino is not counted, a row is complete when it reaches WIDTH.
+    int *row_fill;
+
+    // Current tetromino being manipulated
+    Point *points;
+    // The current shape type, help in rotating the tetromino.
+    enum Tetromino current_shape;
+
+    // Window stat, the center point on the Y-axis.
+    int window_center_y;
+    // Window stat, the center point on the X-axis.
+    int window_center_x;
+
+    // Keep track of the time the main loop refreshes.
+    long current_time;
+
+    // The score in the game
+    int score;
+    // Rows cleared so far, every 10 rows is a new level.
+    int lines;
+    // The level drives the gravity speed and multiplies the points.
+    int level;
+    // Number of locks in a row that cleared rows, minus one. -1 when the last
+    // lock cleared nothing.
+    int combo;
+    // Set when the last clear was a tetris, so the next one is a back to back.
+    int is_back_to_back;
+
+    // Keep track when was the last gravity update.
+    // By gravity, it means the time a tetromino falls by one block.
+    long last_gravity_update_time;
+    // Keep track of when was the last virtual grid update.
+    // This help not overloading the virtual grid too fast which makes the
+    // terminal shift a lot when rendering the grid.
+    long last_virtual_grid_update_time;
+    // Keep track when was the last view rendered. Reduce overloading with
+    // re-renders.
+    long last_view_update_time;
+
+    // track if game is over or not.
+    int is_game_over;
+
+    // Guards the grid and the points, each game has its own so that several
+    // games can run side by side.
+    pthread_mutex_t mutex;
+
+    // Where the game events are recorded, NULL if the game is not recorded.
+    FILE *replay;
+    // The time the game started, replay times are relative to it.
+    long start_time;
+} GameState;
+
+extern char shape_names[7];
+
+long get_current_time();
+int init_game_state(GameState *game_state, FILE *replay);
+void free_game_state(GameState *game_state);
+void record_event(GameState *game_state, char event, char arg);
+void correct_points_after_rotation(Point *points);
+void rotate_tetromino_in_grid(GameState *game_state);
+void clear_tetromino_in_grid(GameState *game_state);
+void place_tetromino_in_grid(GameState *game_state);
+void spawn_tetromino(GameState *game_state, enum Tetromino t);
+void pick_tetromino(GameState *game_state);
+int can_update_virtual_grid(GameState *game_state);
+long gravity_delay(int level);
+int can_update_gravity(GameState *game_state);
+int detect_block_out(GameState *game_state);
+int is_game_over(GameState *game_state);
+int detect_collision_bottom(GameState *game_state);
+int detect_collision_left(GameState *game_state);
+int detect_collision_right(GameState *game_state);
+void shift_points_down(GameState *game_state);
+void shift_points_left(GameState *game_state);
+void shift_points_right(GameState *game_state);
+void merge_tetromino_with_grid(GameState *game_state);
+int clear_full_rows(GameState *game_state);
+ClearEvent score_clear(GameState *game_state, int cleared);
+void soft_drop(GameState *game_state);
+int update(GameState *game_state);
+
+#endif
@@ -0,0 +1,177 @@
+#include "input.h"
+
+#define ESCAPE 0x1b
+
+// Initialize the input state with the given DAS and ARR, in microseconds.
+void init_input_state(InputState *input, long das, long arr) {
+    input->das = das;
+    input->arr = arr;
+    input->held = INPUT_NONE;
+    input->press_time = 0;
+    input->last_event_time = 0;
+    input->next_shift_time = 0;
+    input->is_repeating = 0;
+    input->pending_length = 0;
+}
+
+// Maps the final byte of an arrow key escape sequence to its action.
+enum InputAction decode_arrow(char final) {
+    switch (final) {
+    case 'A':
+        return INPUT_ROTATE;
+    case 'B':
+        return INPUT_SOFT_DROP;
+    case 'C':
+        return INPUT_RIGHT;
+    case 'D':
+        return INPUT_LEFT;
+    default:
+        return INPUT_NONE;
+    }
+}
+
+// Decodes the first key in the buffer into an action. Returns the number of
+// bytes the key used, or 0 if the buffer ends in the middle of an escape
+// sequence and more bytes are needed.
+int decode_input(const char *buffer, int length, enum InputAction *action) {
+    *action = INPUT_NONE;
+    if (length == 0) {
+        return 0;
+    }
+
+    if (buffer[0] == ESCAPE) {
+        if (length == 1) {
+            return 0;
+        }
+        // a lone escape followed by a regular key, skip the escape.
+        if (buffer[1] != '[' && buffer[1] != 'O') {
+            return 1;
+        }
+        // CSI/SS3 sequences end with a byte in the 0x40-0x7e range, anything
+        // in between are parameters.
+        for (int i = 2; i < length; i++) {
+            if (buffer[i] >= 0x40 && buffer[i] <= 0x7e) {
+                *action = decode_arrow(buffer[i]);
+                return i + 1;
+            }
+        }
+        return 0;
+    }
+
+    switch (buffer[0]) {
+    case 'q':
+        *action = INPUT_QUIT;
+        break;
+    case 'j':
+        *action = INPUT_LEFT;
+        break;
+    case 'k':
+        *action = INPUT_RIGHT;
+        break;
+    case ' ':
+        *action = INPUT_ROTATE;
+        break;
+    case 's':
+        *action = INPUT_SOFT_DROP;
+        break;
+    default:
+        break;
+    }
+    return 1;
+}
+
+// Checks if the action can be held down to repeat.
+int is_repeatable(enum InputAction action) {
+    return action == INPUT_LEFT || action == INPUT_RIGHT ||
+           action == INPUT_SOFT_DROP;
+}
+
+// Handles a decoded key at the given time. Returns the number of times the
+// action should be applied right away: 1 for a press, 0 for a terminal repeat
+// the auto shift takes care of.
+//
+// Terminals only send key presses, a held key shows up as a first press, a
+// pause of the terminal's own repeat delay, then a new byte every repeat
+// interval. A key coming more than INPUT_REPEAT_GAP after the previous one is
+// a press. Keys coming faster than that are presses too until the DAS has
+// passed since the first of them, so taps map one to one to moves even when
+// they are read together. Only after that they are the terminal repeating the
+// key, and the auto repeat rate takes over from the terminal's.
+int input_key_event(InputState *input, enum InputAction action, long now) {
+    if (action == INPUT_NONE) {
+        return 0;
+    }
+    if (!is_repeatable(action)) {
+        return 1;
+    }
+
+    if (input->held == action &&
+        now - input->last_event_time <= INPUT_REPEAT_GAP) {
+        input->last_event_time = now;
+        if (input->is_repeating) {
+            return 0;
+        }
+        long das = input->das > INPUT_REPEAT_DELAY ? input->das
+                                                   : INPUT_REPEAT_DELAY;
+        if (now - input->press_time < das) {
+            return 1;
+        }
+        // the key already moved with every byte so far, pick up from here.
+        input->is_repeating = 1;
+        input->next_shift_time = now + input->arr;
+        return 0;
+    }
+
+    input->held = action;
+    input->press_time = now;
+    input->last_event_time = now;
+    input->is_repeating = 0;
+    return 1;
+}
+
+// Returns the number of times the held action should be applied because of
+// the auto shift. The key only counts as held up to INPUT_REPEAT_GAP after the
+// last repeat, so a released key never moves more than the terminal would
+// have.
+int input_auto_shift(InputState *input, long now) {
+    int count = 0;
+    if (input->held == INPUT_NONE) {
+        return 0;
+    }
+
+    long held_until = input->last_event_time + INPUT_REPEAT_GAP;
+    long shift_until = now < held_until ? now : held_until;
+    if (input->is_repeating) {
+        while (shift_until >= input->next_shift_time) {
+            input->next_shift_time += input->arr;
+            // no point in moving further than the playfield, the thread
+            // probably got delayed.
+            if (++count == HEIGHT) {
+                input->next_shift_time = shift_until + input->arr;
+                break;
+            }
+        }
+    }
+
+    if (now > held_until) {
+        input->held = INPUT_NONE;
+    }
+    return count;
+}
+
+// Returns how long to wait for input in milliseconds before the auto shift
+// needs attention, -1 to wait until the next key.
+int input_poll_timeout(InputState *input, long now) {
+    if (input->held == INPUT_NONE) {
+        return -1;
+    }
+    long wake_up_time = input->last_event_time + INPUT_REPEAT_GAP + 1;
+    if (input->is_repeating && input->next_shift_time < wake_up_time) {
+        wake_up_time = input->next_shift_time;
+    }
+    if (wake_up_time <= now) {
+        return 0;
+    }
+    // round up so the wake up is never early.
+    return (wake_up_time - now + 999) / 1000;
+}
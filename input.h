@@ -0,0 +1,65 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include "engine.h"
+
+// Size of the buffer the pending input bytes are read into.
+#define INPUT_BUFFER_SIZE 64
+// Default delayed auto shift, how long the terminal's own repeats go through
+// before the auto repeat rate takes over (200 ms). The terminal cannot tell the
+// game a key is held until it starts repeating it itself, so this comes on top
+// of the terminal's repeat delay.
+#define INPUT_DAS MS_200
+// Default auto repeat rate, the delay between two repeats of a held key
+// (50 ms).
+#define INPUT_ARR MS_50
+// Keys closer than this (50 ms) can be the terminal repeating a held key, keys
+// further apart are always presses. Terminals repeat every 30-40 ms. The key
+// counts as released when the terminal stops repeating it for this long.
+#define INPUT_REPEAT_GAP MS_50
+// No terminal starts repeating a key sooner than this after it was pressed
+// (200 ms), keys coming before are presses however close together they are,
+// like a burst read in one go. The delayed auto shift is never shorter.
+#define INPUT_REPEAT_DELAY MS_200
+
+// The actions a key can be decoded to.
+enum InputAction {
+    INPUT_NONE,
+    INPUT_LEFT,
+    INPUT_RIGHT,
+    INPUT_ROTATE,
+    INPUT_SOFT_DROP,
+    INPUT_QUIT,
+};
+
+// Keeps track of the bytes read but not decoded yet and of the key being
+// held for the auto shift.
+typedef struct {
+    long das;
+    long arr;
+
+    // The movement key currently held, INPUT_NONE if there is none.
+    enum InputAction held;
+    // When the first of the presses in quick succession happened, the held
+    // key's repeats are counted from there.
+    long press_time;
+    // When the held key was last seen, pressed or repeated.
+    long last_event_time;
+    // When the held key should move the tetromino next.
+    long next_shift_time;
+    // Set once the terminal repeats the key, only then the key auto shifts.
+    int is_repeating;
+
+    // Bytes read from the terminal, they can end in the middle of an escape
+    // sequence.
+    char pending[INPUT_BUFFER_SIZE];
+    int pending_length;
+} InputState;
+
+void init_input_state(InputState *input, long das, long arr);
+int decode_input(const char *buffer, int length, enum InputAction *action);
+int input_key_event(InputState *input, enum InputAction action, long now);
+int input_auto_shift(InputState *input, long now);
+int input_poll_timeout(InputState *input, long now);
+
+#endif
@@ -0,0 +1,68 @@
+#include "input.h"
+#include <assert.h>
+#include <stdio.h>
+
+// Feeds the same key at the given times and returns how many times it moved,
+// including the auto shift up to the last key.
+int count_moves(enum InputAction action, const long *times, int count) {
+    InputState input;
+    int moves = 0;
+    init_input_state(&input, INPUT_DAS, INPUT_ARR);
+    for (int i = 0; i < count; i++) {
+        moves += input_auto_shift(&input, times[i]);
+        moves += input_key_event(&input, action, times[i]);
+    }
+    return moves;
+}
+
+// Keys read in one go all get the same time, each of them is a press.
+void test_burst() {
+    long times[8];
+    for (int n = 1; n <= 8; n++) {
+        for (int i = 0; i < n; i++) {
+            times[i] = ONE_SECOND_IN_MS;
+        }
+        assert(count_moves(INPUT_LEFT, times, n) == n);
+    }
+}
+
+// Fast taps move once each.
+void test_taps() {
+    long times[4];
+    for (int i = 0; i < 4; i++) {
+        times[i] = ONE_SECOND_IN_MS + i * 45000;
+    }
+    assert(count_moves(INPUT_RIGHT, times, 4) == 4);
+}
+
+// A held key moves with the terminal's repeats until the DAS, then at the
+// auto repeat rate, and stops when the terminal stops repeating it.
+void test_hold() {
+    InputState input;
+    long now = ONE_SECOND_IN_MS;
+    init_input_state(&input, INPUT_DAS, INPUT_ARR);
+    int moves = input_key_event(&input, INPUT_LEFT, now);
+
+    // terminal repeat delay of 500 ms, then a repeat every 30 ms for a second.
+    for (now += MS_500; now <= 2 * ONE_SECOND_IN_MS + MS_500; now += 30000) {
+        moves += input_auto_shift(&input, now);
+        moves += input_key_event(&input, INPUT_LEFT, now);
+    }
+    assert(input.is_repeating);
+    moves += input_auto_shift(&input, now + ONE_SECOND_IN_MS);
+    assert(input.held == INPUT_NONE);
+
+    // the press, the first repeat and the ones before the DAS, then one every
+    // auto repeat rate for the rest of the second.
+    int expected = 2 + INPUT_DAS / 30000 +
+                   (ONE_SECOND_IN_MS - INPUT_DAS) / INPUT_ARR;
+    assert(moves >= expected - 1 && moves <= expected + 1);
+}
+
+int main() {
+    test_burst();
+    test_taps();
+    test_hold();
+    printf("input: all tests passed\n");
+    return 0;
+}
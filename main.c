@@ -1,96 +1,26 @@
-#include <ncurses.h>
+#include "engine.h"
+#include "input.h"
+#include "metrics.h"
+#include "render.h"
+#include <poll.h>
 #include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
-#include <sys/time.h>
 #include <termios.h>
 #include <time.h>
 #include <unistd.h>
 
-#define HEIGHT 16
-#define WIDTH 10
-#define CLEAR_SCREEN_AND_HIDE_CURSOR "\033[2J\033[?25l"
-#define SHOW_CURSOR "\033[?25h"
-#define ONE_SECOND_IN_MS 1000000
-// Delay in microseconds (50 ms)
-#define MS_50 50000
-// Delay in microseconds (100 ms)
-#define MS_100 100000
-// Delay in microseconds (150 ms)
-#define MS_150 150000
-// Delay in microseconds (500 ms)
-#define MS_500 500000
-// Each tetromino can be represented by 4 points. This is the size of the array
-// containing those points.
-#define TETROMINO_BLOCK_SIZE 4
-
-// This represents the different tetromino available.
-enum Tetromino {
-    I,
-    O,
-    T,
-    S,
-    Z,
-    J,
-    L,
-};
-
-// Represents an individual point/block that makes up a tetromino.
-typedef struct {
-    int x, y;
-} Point;
-
-// A game state. Everything the game needs will be here.
-typedef struct {
-    // A virtual grid to represent the state of the playfield.
-    // This makes it easier to do collision detection, rotation and movement.
-    // Then when everything has been checked, the grid can be printed.
-    int **virtual_grid;
-
-    // Current tetromino being manipulated
-    Point *points;
-    // The current shape type, help in rotating the tetromino.
-    enum Tetromino current_shape;
-
-    // Window stat, the center point on the Y-axis.
-    int window_center_y;
-    // Window stat, the center point on the X-axis.
-    int window_center_x;
-
-    // Keep track of the time the main loop refreshes.
-    long current_time;
-
-    // The score in the game
-    int score;
-
-    // Keep track when was the last gravity update.
-    // By gravity, it means the time a tetromino falls by one block.
-    long last_gravity_update_time;
-    // Keep track of when was the last virtual grid update.
-    // This help not overloading the virtual grid too fast which makes the
-    // terminal shift a lot when rendering the grid.
-    long last_virtual_grid_update_time;
-    // Keep track when was the last view rendered. Reduce overloading with
-    // re-renders.
-    long last_view_update_time;
-
-    // track if game is over or not.
-    int is_game_over;
-} GameState;
-
-int detect_collision_bottom(GameState *game_state);
-int detect_collision_left(GameState *game_state);
-int detect_collision_right(GameState *game_state);
-void shift_points_down(GameState *game_state);
-void shift_points_left(GameState *game_state);
-void shift_points_right(GameState *game_state);
-void check_complete_rows(GameState *game_state);
-
 struct termios original_tio;
-char shape_names[7] = {'I', 'O', 'T', 'S', 'Z', 'J', 'L'};
-pthread_mutex_t mutex;
+// The DAS and ARR in microseconds, they can be changed with -d and -a.
+long input_das = INPUT_DAS;
+long input_arr = INPUT_ARR;
+// How the game is drawn, it can be changed with -b.
+RenderBackend *render_backend = &ansi_backend;
+// Set by the SIGWINCH handler, the main loop does the actual relayout.
+volatile sig_atomic_t is_window_resized = 0;
 
 // Function to restore the terminal to its original settings
 void restore_terminal_settings() {
@@ -110,615 +40,212 @@ void set_non_canonical_mode() {
     tcsetattr(STDIN_FILENO, TCSANOW, &tio);
 }
 
-// Gets the current time in miliseconds. The function uses the system time to
-// calculate the current time.
-long get_current_time() {
-    struct timeval current_time;
-    gettimeofday(&current_time, NULL);
-    return (current_time.tv_sec * ONE_SECOND_IN_MS + current_time.tv_usec);
-}
-
-// Correct any point(s) that are out of bounds after rotation. Each opposite
-// side are exclusive to each other.
-void correct_points_after_rotation(Point *points) {
-    int min_x = 0, min_y = 0, max_x = WIDTH - 1, max_y = HEIGHT - 1,
-        shift_x = 0, shift_y = 0;
-
-    // each opposite side its actually mutually exclusive so they won't
-    // interfere with the final shift amount.
-    for (int i = 0; i < TETROMINO_BLOCK_SIZE; i++) {
-        // left side
-        if (points[i].x < min_x)
-            min_x = points[i].x;
-        // right side
-        if (points[i].x > max_x)
-            max_x = points[i].x;
-
-        // top side
-        if (points[i].y < min_y)
-            min_y = points[i].y;
-        // bottom side
-        if (points[i].y > max_y)
-            max_y = points[i].y;
-    }
-
-    if (min_x < 0)
-        // shift right, change sign, negative to positive with double negative
-        shift_x = -min_x;
-    if (min_y < 0)
-        // shift down, change sign, negative to positive with double negative
-        shift_y = -min_y;
-    if (max_x >= WIDTH)
-        // shift left
-        shift_x = WIDTH - 1 - max_x;
-    if (max_y >= HEIGHT)
-        // shift up
-        shift_y = HEIGHT - 1 - max_y;
-
-    for (int i = 0; i < TETROMINO_BLOCK_SIZE; i++) {
-        points[i].x += shift_x;
-        points[i].y += shift_y;
-    }
-}
-
-// Rotate the currently manipulated tetromino in the grid clockwise.
-void rotate_tetromino_in_grid(Point *points) {
-    Point pivot = points[2];
-    int x, y, rotated_x, rotated_y;
-    pthread_mutex_lock(&mutex);
-    for (int i = 0; i < TETROMINO_BLOCK_SIZE; i++) {
-        x = points[i].x - pivot.x;
-        y = points[i].y - pivot.y;
-        rotated_x = y + pivot.x;
-        rotated_y = -x + pivot.y;
-        points[i].x = rotated_x;
-        points[i].y = rotated_y;
-    }
-
-    // correct the points if out of bounce
-    correct_points_after_rotation(points);
-    pthread_mutex_unlock(&mutex);
-}
-
-// Clears the tetromino described by the points on the grid.
-void clear_tetromino_in_grid(int **grid, Point *points) {
-    int x, y;
-    pthread_mutex_lock(&mutex);
-    for (int i = 0; i < TETROMINO_BLOCK_SIZE; i++) {
-        x = points[i].x, y = points[i].y;
-        grid[y][x] = 0;
-    }
-    pthread_mutex_unlock(&mutex);
-}
-
-// Places the tetromino described by the points on the grid.
-void place_tetromino_in_grid(int **grid, Point *points) {
-    int x, y;
-    pthread_mutex_lock(&mutex);
-    for (int i = 0; i < TETROMINO_BLOCK_SIZE; i++) {
-        x = points[i].x, y = points[i].y;
-        grid[y][x] = 1;
-    }
-    pthread_mutex_unlock(&mutex);
-}
-
-// Send the current tetromino immmediately down.
-// void instant_fall(GameState *game_state) {
-//     Point lowest_point = {0, 0};
-//     int max_y = 0, shift_y = 0;
-//     // find the lowest point of the tetromino
-//     for (int i = 0; i < TETROMINO_BLOCK_SIZE; i++) {
-//         if (game_state->points[i].y > lowest_point.y)
-//             lowest_point = game_state->points[i];
-//     }
-//     // find the shift amount from lowest point to bottom
-//     for (int y = lowest_point.y; y < HEIGHT; y++) {
-//         if (game_state->virtual_grid[y][lowest_point.x] == 0) {
-//             shift_y += 1;
-//         } else {
-//             break;
-//         }
-//     }
-//     // shift the tetromino points
-//     for (int i = 0; i < TETROMINO_BLOCK_SIZE; i++) {
-//         game_state->points[i].y += shift_y;
-//         if (game_state->points[i].y >= HEIGHT) {
-//             game_state->points[i].y = HEIGHT - 1;
-//         }
-//     }
-// }
-
-// This is a thread function that is responsible of handling reading inputs from
-// stdin.
-void *read_from_stdin(void *arg) {
-    GameState *game_state = (GameState *)arg;
-    char ch;
-    long last_input_time = 0, current_input_time;
-    while (!game_state->is_game_over) {
-        if (read(STDIN_FILENO, &ch, 1) > 0) {
-            if (ch == 'q') {
-                game_state->is_game_over = 1;
-            } else {
-                current_input_time = get_current_time();
-                if (last_input_time == 0 ||
-                    current_input_time - last_input_time >= MS_50) {
-                    last_input_time = current_input_time;
-                    clear_tetromino_in_grid(game_state->virtual_grid,
-                                            game_state->points);
-                    // read movements
-                    switch (ch) {
-                    case 'j':
-                        shift_points_left(game_state);
-                        break;
-                    case 'k':
-                        shift_points_right(game_state);
-                        break;
-                    case ' ':
-                        // do not rotate a tetromino that doesn't change after
-                        // rotation.
-                        if (game_state->current_shape != O) {
-                            rotate_tetromino_in_grid(game_state->points);
-                        }
-                        break;
-                    case '\n':
-                        // if (!detect_collision_bottom(game_state)) {
-                        //     instant_fall(game_state);
-                        // }
-                        break;
-                    default:
-                        break;
-                    }
-                    place_tetromino_in_grid(game_state->virtual_grid,
-                                            game_state->points);
-                }
-            }
-        }
+// Applies an input action to the currently manipulated tetromino. The game
+// lock is held for the whole action so it is atomic with respect to update.
+void apply_input_action(GameState *game_state, enum InputAction action) {
+    pthread_mutex_lock(&game_state->mutex);
+    // the tetromino of a block out overlaps locked blocks, clearing it would
+    // remove them.
+    if (game_state->is_game_over) {
+        pthread_mutex_unlock(&game_state->mutex);
+        return;
     }
-    return NULL;
-}
-
-// Randomly picks a tetromino and sets the default starting points of a
-// tetromino in the game state.
-void pick_tetromino(GameState *game_state) {
-    enum Tetromino t = rand() % 7;
-    pthread_mutex_lock(&mutex);
-    switch (t) {
-    case I:
-        // Shape
-        // [][][][]
-        for (int i = 0; i < TETROMINO_BLOCK_SIZE; i++) {
-            game_state->points[i].y = 0;
-            game_state->points[i].x = WIDTH / 2 + i - 2;
-        }
+    clear_tetromino_in_grid(game_state);
+    switch (action) {
+    case INPUT_LEFT:
+        shift_points_left(game_state);
+        record_event(game_state, REPLAY_LEFT, 0);
         break;
-    case T:
-        // Shape
-        //   []
-        // [][][]
-        // top middle point
-        game_state->points[0].y = 0;
-        game_state->points[0].x = WIDTH / 2 - 1;
-
-        // lower left point
-        game_state->points[1].y = 1;
-        game_state->points[1].x = WIDTH / 2 - 2;
-
-        // lower middle point
-        game_state->points[2].y = 1;
-        game_state->points[2].x = WIDTH / 2 - 1;
-
-        // lower right point
-        game_state->points[3].y = 1;
-        game_state->points[3].x = WIDTH / 2;
+    case INPUT_RIGHT:
+        shift_points_right(game_state);
+        record_event(game_state, REPLAY_RIGHT, 0);
         break;
-    case O:
-        // Shape
-        // [][]
-        // [][]
-        game_state->points[0].y = 0;
-        game_state->points[0].x = WIDTH / 2 - 1;
-
-        game_state->points[1].y = 0;
-        game_state->points[1].x = WIDTH / 2;
-
-        game_state->points[2].y = 1;
-        game_state->points[2].x = WIDTH / 2 - 1;
-
-        game_state->points[3].y = 1;
-        game_state->points[3].x = WIDTH / 2;
-        break;
-    case S:
-        // Shape
-        //   [][]
-        // [][]
-        // top middle point
-        game_state->points[0].y = 0;
-        game_state->points[0].x = WIDTH / 2 - 1;
-
-        // top right point
-        game_state->points[1].y = 0;
-        game_state->points[1].x = WIDTH / 2;
-
-        // lower middle point
-        game_state->points[2].y = 1;
-        game_state->points[2].x = WIDTH / 2 - 1;
-
-        // lower left point
-        game_state->points[3].y = 1;
-        game_state->points[3].x = WIDTH / 2 - 2;
-        break;
-    case Z:
-        // Shape
-        // [][]
-        //   [][]
-        // top left point
-        game_state->points[0].y = 0;
-        game_state->points[0].x = WIDTH / 2 - 1;
-
-        // top middle point
-        game_state->points[1].y = 0;
-        game_state->points[1].x = WIDTH / 2;
-
-        // lower middle point
-        game_state->points[2].y = 1;
-        game_state->points[2].x = WIDTH / 2;
-
-        // lower right point
-        game_state->points[3].y = 1;
-        game_state->points[3].x = WIDTH / 2 + 1;
+    case INPUT_ROTATE:
+        // do not rotate a tetromino that doesn't change after rotation.
+        if (game_state->current_shape != O) {
+            rotate_tetromino_in_grid(game_state);
+            record_event(game_state, REPLAY_ROTATE, 0);
+        }
         break;
-    case L:
-        // Shape
-        //     []
-        // [][][]
-        // top right point
-        game_state->points[0].y = 0;
-        game_state->points[0].x = WIDTH / 2;
-
-        // lower left point
-        game_state->points[1].y = 1;
-        game_state->points[1].x = WIDTH / 2 - 2;
-
-        // lower middle point
-        game_state->points[2].y = 1;
-        game_state->points[2].x = WIDTH / 2 - 1;
-
-        // lower right point
-        game_state->points[3].y = 1;
-        game_state->points[3].x = WIDTH / 2;
+    case INPUT_SOFT_DROP:
+        soft_drop(game_state);
+        record_event(game_state, REPLAY_SOFT_DROP, 0);
         break;
-    case J:
-        // Shape
-        // []
-        // [][][]
-        // top left point
-        game_state->points[0].y = 0;
-        game_state->points[0].x = WIDTH / 2 - 2;
-
-        // lower left point
-        game_state->points[1].y = 1;
-        game_state->points[1].x = WIDTH / 2 - 2;
-
-        // lower middle point
-        game_state->points[2].y = 1;
-        game_state->points[2].x = WIDTH / 2 - 1;
-
-        // lower right point
-        game_state->points[3].y = 1;
-        game_state->points[3].x = WIDTH / 2;
+    default:
         break;
     }
-    pthread_mutex_unlock(&mutex);
-    game_state->current_shape = t;
+    place_tetromino_in_grid(game_state);
+    pthread_mutex_unlock(&game_state->mutex);
 }
 
-// Initialize the game, includes playfield and picks the starting tetromino.
-void init(GameState *game_state) {
-    // Window stats
-    struct winsize *window = malloc(sizeof(struct winsize));
-    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, window) == -1) {
-        perror("ioctl");
-        return;
-    }
-
-    // get the center points
-    game_state->window_center_y = window->ws_row / 2 - HEIGHT / 2;
-    game_state->window_center_x = window->ws_col / 2 - WIDTH - 1;
-
-    // no need of it anymore.
-    free(window);
-    window = NULL;
-
-    // set the random seed
-    srand(time(0));
-
-    set_non_canonical_mode();
+// This is a thread function that is responsible of handling reading inputs from
+// stdin. Every wake up reads all the pending bytes so no key is lost, and the
+// held keys are repeated according to the DAS and ARR.
+void *read_from_stdin(void *arg) {
+    GameState *game_state = (GameState *)arg;
+    struct pollfd stdin_poll = {STDIN_FILENO, POLLIN, 0};
+    enum InputAction action;
+    InputState input;
+    int offset, used, count, timeout;
+    ssize_t n;
 
-    // init the points array
-    game_state->points = (Point *)malloc(TETROMINO_BLOCK_SIZE * sizeof(Point));
-    pick_tetromino(game_state);
+    init_input_state(&input, input_das, input_arr);
+    while (!game_state->is_game_over) {
+        timeout = input_poll_timeout(&input, get_current_time());
+        if (poll(&stdin_poll, 1, timeout) > 0) {
+            n = read(STDIN_FILENO, input.pending + input.pending_length,
+                     INPUT_BUFFER_SIZE - input.pending_length);
+            if (n <= 0) {
+                continue;
+            }
+            input.pending_length += n;
+
+            offset = 0;
+            while ((used = decode_input(input.pending + offset,
+                                        input.pending_length - offset,
+                                        &action)) > 0) {
+                offset += used;
+                metrics_add(METRIC_INPUT_EVENTS, 1);
+                if (action == INPUT_QUIT) {
+                    record_event(game_state, REPLAY_QUIT, 0);
+                    game_state->is_game_over = 1;
+                    return NULL;
+                }
+                count = input_key_event(&input, action, get_current_time());
+                if (count == 0 && action != INPUT_NONE) {
+                    metrics_add(METRIC_INPUT_REPEATS, 1);
+                }
+                for (int i = 0; i < count; i++) {
+                    apply_input_action(game_state, action);
+                }
+            }
 
-    game_state->virtual_grid = (int **)malloc(HEIGHT * sizeof(int *));
-    for (int y = 0; y < HEIGHT; y++) {
-        game_state->virtual_grid[y] = (int *)malloc(WIDTH * sizeof(int));
-        for (int x = 0; x < WIDTH; x++) {
-            game_state->virtual_grid[y][x] = 0;
+            // keep an unfinished escape sequence for the next read, unless it
+            // can never finish because the buffer is full.
+            if (offset == 0 && input.pending_length == INPUT_BUFFER_SIZE) {
+                offset = INPUT_BUFFER_SIZE;
+            }
+            input.pending_length -= offset;
+            memmove(input.pending, input.pending + offset,
+                    input.pending_length);
         }
-    }
-    place_tetromino_in_grid(game_state->virtual_grid, game_state->points);
-
-    game_state->last_view_update_time = 0;
-    game_state->last_gravity_update_time = 0;
-    game_state->last_virtual_grid_update_time = 0;
-
-    game_state->score = 0;
-
-    game_state->is_game_over = 0;
-}
-
-// cleans up after the game
-void clean_up(GameState *game_state) {
-    for (int y = 0; y < HEIGHT; y++) {
-        free(game_state->virtual_grid[y]);
-    }
-    free(game_state->virtual_grid);
-    free(game_state->points);
 
-    printf(SHOW_CURSOR);
-}
-
-// Checks if 100ms has passed since the last update.
-int can_update_virtual_grid(GameState *game_state) {
-    return game_state->last_virtual_grid_update_time == 0 ||
-           game_state->current_time -
-                   game_state->last_virtual_grid_update_time >=
-               MS_50;
-}
-
-// Checks if 600ms has passed since the last update.
-int can_update_gravity(GameState *game_state) {
-    return game_state->last_gravity_update_time == 0 ||
-           game_state->current_time - game_state->last_gravity_update_time >=
-               MS_500;
-}
-
-// Check if game is over or not, this should only be called when a bottom
-// collision happens.
-int is_game_over(GameState *game_state) {
-    for (int i = 0; i < TETROMINO_BLOCK_SIZE; i++) {
-        if (game_state->points[i].y - 1 < 0) {
-            return 1;
+        count = input_auto_shift(&input, get_current_time());
+        for (int i = 0; i < count; i++) {
+            apply_input_action(game_state, input.held);
         }
     }
-    return 0;
+    return NULL;
 }
 
-// Collision detection on the bottom of the current points.
-int detect_collision_bottom(GameState *game_state) {
-    for (int i = 0; i < TETROMINO_BLOCK_SIZE; i++) {
-        int peek_y = game_state->points[i].y + 1;
-        if (peek_y >= HEIGHT ||
-            game_state->virtual_grid[peek_y][game_state->points[i].x] == 1) {
-            return 1;
-        }
+// Gets the window size and computes the point where the view starts so that
+// it is centered. Returns 0 on success.
+int update_window_center(GameState *game_state) {
+    struct winsize window;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &window) == -1) {
+        perror("ioctl");
+        return 1;
     }
-    return 0;
-}
 
-// Collision detection on the left of the current points.
-int detect_collision_left(GameState *game_state) {
-    for (int i = 0; i < TETROMINO_BLOCK_SIZE; i++) {
-        int peek_x = game_state->points[i].x - 1;
-        if (peek_x < 0 ||
-            game_state->virtual_grid[game_state->points[i].y][peek_x] == 1) {
-            return 1;
-        }
-    }
+    game_state->window_center_y = window.ws_row / 2 - RENDERED_HEIGHT / 2;
+    game_state->window_center_x = window.ws_col / 2 - RENDERED_WIDTH / 2;
+    // keep the view on screen when the window is too small.
+    if (game_state->window_center_y < 0)
+        game_state->window_center_y = 0;
+    if (game_state->window_center_x < 0)
+        game_state->window_center_x = 0;
     return 0;
 }
 
-// Collision detection on the right of the current points.
-int detect_collision_right(GameState *game_state) {
-    for (int i = 0; i < TETROMINO_BLOCK_SIZE; i++) {
-        int peek_x = game_state->points[i].x + 1;
-        if (peek_x >= WIDTH ||
-            game_state->virtual_grid[game_state->points[i].y][peek_x] == 1) {
-            return 1;
-        }
-    }
-    return 0;
+// Only flags the resize, the relayout happens in the main loop.
+void handle_window_resize(int signal) {
+    (void)signal;
+    is_window_resized = 1;
 }
 
-// Shifts the current points 1 unit down if possible, otherwise it will stay the
-// same.
-void shift_points_down(GameState *game_state) {
-    if (detect_collision_bottom(game_state)) {
+// Recomputes the layout after the window changed size and makes the backend
+// draw the whole view again.
+void relayout(GameState *game_state) {
+    is_window_resized = 0;
+    if (update_window_center(game_state) != 0) {
         return;
     }
-    pthread_mutex_lock(&mutex);
-    for (int i = 0; i < TETROMINO_BLOCK_SIZE; i++) {
-        game_state->points[i].y++;
-    }
-    pthread_mutex_unlock(&mutex);
+    render_backend->resize(game_state);
+    game_state->last_view_update_time = 0;
 }
 
-// Shifts the current points 1 unit left if possible, otherwise it will stay the
-// same.
-void shift_points_left(GameState *game_state) {
-    if (detect_collision_left(game_state)) {
-        return;
-    }
-    pthread_mutex_lock(&mutex);
-    for (int i = 0; i < TETROMINO_BLOCK_SIZE; i++) {
-        game_state->points[i].x--;
-    }
-    pthread_mutex_unlock(&mutex);
-}
+// Initialize the game, includes playfield and picks the starting tetromino.
+// The replay file can be NULL if the game should not be recorded.
+int init(GameState *game_state, FILE *replay) {
+    struct sigaction resize_action;
 
-// Shifts the current points 1 unit right if possible, otherwise it will stay
-// the same.
-void shift_points_right(GameState *game_state) {
-    if (detect_collision_right(game_state)) {
-        return;
-    }
-    pthread_mutex_lock(&mutex);
-    for (int i = 0; i < TETROMINO_BLOCK_SIZE; i++) {
-        game_state->points[i].x++;
+    if (update_window_center(game_state) != 0) {
+        return 1;
     }
-    pthread_mutex_unlock(&mutex);
-}
 
-// Merges the current manipulated tetromino into the grid.
-void merge_tetromino_with_grid(GameState *game_state) {
-    pthread_mutex_lock(&mutex);
-    for (int i = 0; i < TETROMINO_BLOCK_SIZE; i++) {
-        game_state
-            ->virtual_grid[game_state->points[i].y][game_state->points[i].x] =
-            1;
-    }
-    pthread_mutex_unlock(&mutex);
-}
+    // set the random seed
+    srand(time(0));
 
-// Erases the completed rows from bottom up.
-void clear_full_rows(GameState *game_state) {
-    int is_full_row;
-    pthread_mutex_lock(&mutex);
-    for (int y = 0; y < HEIGHT; y++) {
-        // assume it is full row
-        is_full_row = 1;
-        // verify if it is full row
-        for (int x = 0; x < WIDTH; x++) {
-            if (game_state->virtual_grid[y][x] == 0) {
-                is_full_row = 0;
-                break;
-            }
-        }
-        if (is_full_row) {
-            // clear full row and shift upper rows down
-            for (int yy = y; yy > 0; yy--) {
-                for (int xx = 0; xx < WIDTH; xx++) {
-                    game_state->virtual_grid[yy][xx] =
-                        game_state->virtual_grid[yy - 1][xx];
-                }
-            }
-            // clear top row
-            for (int xx = 0; xx < WIDTH; xx++) {
-                game_state->virtual_grid[0][xx] = 0;
-            }
-            // move back one row because all rows have been shifted down
-            y--;
-            // give some points
-            game_state->score += 100;
-        }
+    if (init_game_state(game_state, replay) != 0) {
+        perror("pthread_mutex_init");
+        return 1;
     }
-    pthread_mutex_unlock(&mutex);
-}
 
-// Update the virtual grid according to various states.
-int update(GameState *game_state) {
-    if (can_update_virtual_grid(game_state)) {
-        clear_tetromino_in_grid(game_state->virtual_grid, game_state->points);
-    }
+    // save the terminal settings before the backend touches them, ncurses
+    // changes the modes in its init and they must not be what is restored.
+    set_non_canonical_mode();
 
-    if (can_update_virtual_grid(game_state) &&
-        detect_collision_bottom(game_state)) {
-        if (is_game_over(game_state)) {
-            game_state->is_game_over = 1;
-        } else {
-            merge_tetromino_with_grid(game_state);
-            clear_full_rows(game_state);
-            pick_tetromino(game_state);
-        }
-    } else if (can_update_gravity(game_state)) {
-        game_state->last_gravity_update_time = game_state->current_time;
-        shift_points_down(game_state);
+    if (render_backend->init(game_state) != 0) {
+        free_game_state(game_state);
+        return 1;
     }
 
-    if (can_update_virtual_grid(game_state)) {
-        game_state->last_virtual_grid_update_time = game_state->current_time;
-        place_tetromino_in_grid(game_state->virtual_grid, game_state->points);
-    }
+    memset(&resize_action, 0, sizeof(resize_action));
+    resize_action.sa_handler = handle_window_resize;
+    resize_action.sa_flags = SA_RESTART;
+    sigaction(SIGWINCH, &resize_action, NULL);
 
+    pick_tetromino(game_state);
+    place_tetromino_in_grid(game_state);
     return 0;
 }
 
-// This will allocate a new array of empty spaces of size n.
-char *get_spaces(int n) {
-    char *spaces = (char *)malloc(n * sizeof(char));
-    if (spaces == NULL) {
-        return NULL;
-    }
-    for (int i = 0; i < n; i++) {
-        spaces[i] = ' ';
+// cleans up after the game
+void clean_up(GameState *game_state) {
+    render_backend->end(game_state);
+
+    free_game_state(game_state);
+    if (game_state->replay != NULL) {
+        fclose(game_state->replay);
     }
-    return spaces;
 }
 
 // Renders the virtual grid.
 int view(GameState *game_state) {
+    int written = 0;
+    if (is_window_resized) {
+        relayout(game_state);
+    }
+
     if (game_state->is_game_over) {
-        // get spaces to center the view
-        char *spaces = get_spaces(game_state->window_center_x);
-        // clear the screen
-        printf(CLEAR_SCREEN_AND_HIDE_CURSOR);
-        printf("%sGame Over", spaces);
-        for (int s = 0; s < game_state->window_center_y; s++) {
-            printf("\n");
-        }
+        written = render_backend->draw_game_over(game_state);
+        metrics_add(METRIC_FRAMES_RENDERED, 1);
     } else if (game_state->last_view_update_time == 0 ||
                game_state->current_time - game_state->last_view_update_time >=
                    MS_50) {
         // update the view update time
         game_state->last_view_update_time = game_state->current_time;
 
-        // get spaces to center the view
-        char *spaces = get_spaces(game_state->window_center_x);
-
-        // clear the screen
-        printf(CLEAR_SCREEN_AND_HIDE_CURSOR);
-
-        // print game title and score
-        printf("%sTetris! Score: %7d\n", spaces, game_state->score);
-
-        // calculate the real rendered width of the grid
-        // Multiply by 2 because each 1 or block of the tetromino
-        // is two characters long and plus 2 to make up for the left/right
-        // borders.
-        int real_rendered_width = WIDTH * 2 + 2;
-
-        // print the top border
-        printf("%s", spaces);
-        for (int s = 0; s < real_rendered_width; s++) {
-            printf("-");
-        }
-        printf("\n");
-
-        // print the grid
-        for (int y = 0; y < HEIGHT; y++) {
-            printf("%s", spaces);
-            printf(":");
-            for (int x = 0; x < WIDTH; x++) {
-                if (game_state->virtual_grid[y][x] == 1) {
-                    printf("[]");
-                } else {
-                    printf("  ");
-                }
-            }
-            printf(":\n");
-        }
-
-        // print the bottom border
-        printf("%s", spaces);
-        for (int s = 0; s < real_rendered_width; s++) {
-            printf("-");
-        }
-        printf("\n");
-        printf("%sShape: %c", spaces, shape_names[game_state->current_shape]);
-
-        for (int s = 0; s < game_state->window_center_y - 1; s++) {
-            printf("\n");
-        }
+        // the input thread changes the grid under the lock, drawing without it
+        // could show a tetromino halfway through a move or rows being cleared.
+        pthread_mutex_lock(&game_state->mutex);
+        written = render_backend->draw(game_state);
+        pthread_mutex_unlock(&game_state->mutex);
+        metrics_add(METRIC_FRAMES_RENDERED, 1);
+    } else {
+        metrics_add(METRIC_FRAMES_SKIPPED, 1);
     }
+    metrics_add(METRIC_RENDER_BYTES, written);
     return 0;
 }
 
@@ -738,37 +265,101 @@ void debug_grid(int **grid) {
     }
 }
 
-int main() {
+// Usage: tetris [-b ansi|ncurses] [-d das-ms] [-a arr-ms] [-m metrics-socket]
+//               [replay-file]
+// When a replay file is given, the game events are recorded into it so the
+// game can be analyzed later with tetris-analyze. When a metrics socket is
+// given, the game metrics are served on it in the Prometheus text format.
+// The DAS and ARR tune how held keys repeat and the backend picks how the game
+// is drawn.
+int main(int argc, char **argv) {
     // thread to read from stdin without blocking the main loop.
     pthread_t thread_id;
+    FILE *replay = NULL;
+    const char *metrics_socket = NULL;
+    long loop_start_time;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:d:a:m:")) != -1) {
+        switch (opt) {
+        case 'b':
+            if (strcmp(optarg, ansi_backend.name) == 0) {
+                render_backend = &ansi_backend;
+            } else if (strcmp(optarg, ncurses_backend.name) == 0) {
+                render_backend = &ncurses_backend;
+            } else {
+                opt = 0;
+            }
+            break;
+        case 'd':
+            input_das = atol(optarg) * 1000;
+            break;
+        case 'a':
+            input_arr = atol(optarg) * 1000;
+            break;
+        case 'm':
+            metrics_socket = optarg;
+            break;
+        default:
+            opt = 0;
+            break;
+        }
+        if (opt == 0 || input_das < 0 || input_arr <= 0) {
+            fprintf(stderr,
+                    "Usage: %s [-b ansi|ncurses] [-d das-ms] [-a arr-ms] "
+                    "[-m metrics-socket] [replay-file]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    if (optind < argc) {
+        replay = fopen(argv[optind], "w");
+        if (replay == NULL) {
+            perror("fopen");
+            return 1;
+        }
+    }
+
+    if (metrics_socket != NULL && metrics_start_server(metrics_socket) != 0) {
+        if (replay != NULL) {
+            fclose(replay);
+        }
+        return 1;
+    }
 
     // create a new game state
     GameState game_state;
-    init(&game_state);
-
-    if (pthread_mutex_init(&mutex, NULL) != 0) {
-        perror("pthread_mutex_init");
-        clean_up(&game_state);
+    if (init(&game_state, replay) != 0) {
+        if (replay != NULL) {
+            fclose(replay);
+        }
+        metrics_stop_server();
         return 1;
     }
 
     if (pthread_create(&thread_id, NULL, read_from_stdin, &game_state) != 0) {
         perror("pthread_create");
         clean_up(&game_state);
+        metrics_stop_server();
         return 1;
     }
 
+    metrics_add(METRIC_GAMES_RUNNING, 1);
     while (!game_state.is_game_over) {
-        game_state.current_time = get_current_time();
+        loop_start_time = get_current_time();
+        game_state.current_time = loop_start_time;
         update(&game_state);
         view(&game_state);
+        metrics_observe_latency(get_current_time() - loop_start_time);
     }
+    metrics_add(METRIC_GAMES_RUNNING, -1);
 
     pthread_cancel(thread_id);
     pthread_join(thread_id, NULL);
-    pthread_mutex_destroy(&mutex);
 
     clean_up(&game_state);
+    metrics_stop_server();
 
     return 0;
 }
@@ -0,0 +1,271 @@
+#include "metrics.h"
+#include "engine.h"
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+// Big enough for every metric and every latency bucket.
+#define METRICS_BUFFER_SIZE 8192
+
+// The metrics written by a single thread. The alignment pads the slot to a
+// multiple of the cache line.
+typedef struct {
+    _Alignas(METRICS_CACHE_LINE) atomic_long values[METRIC_COUNT];
+    atomic_long latency_buckets[METRICS_LATENCY_BUCKETS];
+} MetricSlot;
+
+// Name, type and help of each metric, in the same order as the enum.
+static const char *metric_names[METRIC_COUNT][3] = {
+    {"tetris_frames_rendered_total", "counter", "Frames rendered."},
+    {"tetris_frames_skipped_total", "counter",
+     "Main loop iterations that did not render a frame."},
+    {"tetris_ticks_total", "counter", "Main loop updates."},
+    {"tetris_pieces_spawned_total", "counter", "Tetrominos spawned."},
+    {"tetris_lines_cleared_total", "counter", "Rows cleared."},
+    {"tetris_input_events_total", "counter", "Keys decoded from the input."},
+    {"tetris_input_repeats_total", "counter",
+     "Key repeats left to the auto repeat rate."},
+    {"tetris_render_bytes_total", "counter",
+     "Bytes written by the view, ansi backend only."},
+    {"tetris_games_running", "gauge", "Games currently running."},
+    {NULL, NULL, NULL},
+    {NULL, NULL, NULL},
+};
+
+static MetricSlot slots[METRICS_MAX_THREADS];
+static atomic_int next_slot;
+static _Thread_local MetricSlot *thread_slot;
+
+static pthread_t server_thread;
+static int server_fd = -1;
+static char server_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+
+// Gets the slot of the calling thread, assigning one on first use.
+static MetricSlot *get_slot() {
+    if (thread_slot == NULL) {
+        int i = atomic_fetch_add_explicit(&next_slot, 1, memory_order_relaxed);
+        thread_slot = &slots[i % METRICS_MAX_THREADS];
+    }
+    return thread_slot;
+}
+
+// Adds n to the metric. Gauges can be decreased with a negative n.
+void metrics_add(enum Metric metric, long n) {
+    atomic_fetch_add_explicit(&get_slot()->values[metric], n,
+                              memory_order_relaxed);
+}
+
+// Records the latency of one main loop iteration, in microseconds.
+void metrics_observe_latency(long latency) {
+    MetricSlot *slot = get_slot();
+    int bucket = 0;
+    while (bucket < METRICS_LATENCY_BUCKETS - 1 && (1L << bucket) <= latency) {
+        bucket++;
+    }
+    atomic_fetch_add_explicit(&slot->latency_buckets[bucket], 1,
+                              memory_order_relaxed);
+    atomic_fetch_add_explicit(&slot->values[METRIC_LOOP_LATENCY_SUM], latency,
+                              memory_order_relaxed);
+    atomic_fetch_add_explicit(&slot->values[METRIC_LOOP_LATENCY_COUNT], 1,
+                              memory_order_relaxed);
+}
+
+// Sums a metric over every slot.
+static long sum_metric(enum Metric metric) {
+    long total = 0;
+    for (int i = 0; i < METRICS_MAX_THREADS; i++) {
+        total += atomic_load_explicit(&slots[i].values[metric],
+                                      memory_order_relaxed);
+    }
+    return total;
+}
+
+// Estimates a latency quantile as the upper bound of the bucket it falls in.
+// NaN when nothing was observed yet and +Inf when it falls in the last bucket,
+// which has no upper bound.
+static double latency_quantile(long *buckets, long count, double quantile) {
+    long rank = (long)(quantile * count), seen = 0;
+    if (count == 0) {
+        return NAN;
+    }
+    for (int b = 0; b < METRICS_LATENCY_BUCKETS - 1; b++) {
+        seen += buckets[b];
+        if (seen > rank) {
+            return 1L << b;
+        }
+    }
+    return INFINITY;
+}
+
+// Writes a value the way the Prometheus text format spells it.
+static int format_value(char *buffer, int size, double value) {
+    if (isnan(value)) {
+        return snprintf(buffer, size, "NaN");
+    }
+    if (isinf(value)) {
+        return snprintf(buffer, size, "+Inf");
+    }
+    return snprintf(buffer, size, "%.0f", value);
+}
+
+// Writes every metric in the Prometheus text format. Returns the length.
+static int format_metrics(char *buffer, int size) {
+    long buckets[METRICS_LATENCY_BUCKETS] = {0};
+    double quantiles[] = {0.5, 0.9, 0.99};
+    int length = 0;
+
+    for (int m = 0; m < METRIC_COUNT; m++) {
+        if (metric_names[m][0] == NULL) {
+            continue;
+        }
+        length += snprintf(buffer + length, size - length,
+                           "# HELP %s %s\n# TYPE %s %s\n%s %ld\n",
+                           metric_names[m][0], metric_names[m][2],
+                           metric_names[m][0], metric_names[m][1],
+                           metric_names[m][0], sum_metric(m));
+    }
+
+    for (int i = 0; i < METRICS_MAX_THREADS; i++) {
+        for (int b = 0; b < METRICS_LATENCY_BUCKETS; b++) {
+            buckets[b] += atomic_load_explicit(&slots[i].latency_buckets[b],
+                                               memory_order_relaxed);
+        }
+    }
+    long count = sum_metric(METRIC_LOOP_LATENCY_COUNT);
+    length += snprintf(buffer + length, size - length,
+                       "# HELP tetris_loop_latency_microseconds Main loop "
+                       "iteration latency.\n"
+                       "# TYPE tetris_loop_latency_microseconds summary\n");
+    for (int q = 0; q < 3; q++) {
+        char value[32];
+        format_value(value, sizeof(value),
+                     latency_quantile(buckets, count, quantiles[q]));
+        length += snprintf(buffer + length, size - length,
+                           "tetris_loop_latency_microseconds{quantile=\"%g\"} "
+                           "%s\n",
+                           quantiles[q], value);
+    }
+    length += snprintf(buffer + length, size - length,
+                       "tetris_loop_latency_microseconds_sum %ld\n"
+                       "tetris_loop_latency_microseconds_count %ld\n",
+                       sum_metric(METRIC_LOOP_LATENCY_SUM), count);
+    return length;
+}
+
+// This is a thread function that serves the metrics to every client that
+// connects to the socket. Clients that send an HTTP request get an HTTP
+// response, anything else gets the plain text.
+static void *serve_metrics(void *arg) {
+    char buffer[METRICS_BUFFER_SIZE], request[256];
+    struct timeval timeout = {0, 100000};
+    (void)arg;
+
+    for (;;) {
+        int client = accept(server_fd, NULL, NULL);
+        if (client == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            // out of descriptors or memory, give it time to clear up instead
+            // of spinning on accept.
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS ||
+                errno == ENOMEM) {
+                usleep(MS_100);
+                continue;
+            }
+            perror("accept");
+            break;
+        }
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        ssize_t request_length = recv(client, request, sizeof(request), 0);
+
+        int length = format_metrics(buffer, sizeof(buffer));
+        if (request_length >= 4 && memcmp(request, "GET ", 4) == 0) {
+            char header[128];
+            int header_length =
+                snprintf(header, sizeof(header),
+                         "HTTP/1.0 200 OK\r\nContent-Type: text/plain; "
+                         "version=0.0.4\r\nContent-Length: %d\r\n\r\n",
+                         length);
+            send(client, header, header_length, MSG_NOSIGNAL);
+        }
+        send(client, buffer, length, MSG_NOSIGNAL);
+        close(client);
+    }
+    return NULL;
+}
+
+// Starts serving the metrics on a Unix domain socket at the given path from a
+// background thread. Returns 0 on success.
+int metrics_start_server(const char *path) {
+    struct sockaddr_un address;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "metrics socket path too long: %s\n", path);
+        return 1;
+    }
+
+    server_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server_fd == -1) {
+        perror("socket");
+        return 1;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+    strcpy(server_path, path);
+    // a stale socket from a previous run would make bind fail, but anything
+    // else at that path is not ours to remove.
+    struct stat st;
+    if (lstat(path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            fprintf(stderr, "metrics socket path exists and is not a socket: "
+                            "%s\n",
+                    path);
+            close(server_fd);
+            server_fd = -1;
+            return 1;
+        }
+        unlink(path);
+    }
+    if (bind(server_fd, (struct sockaddr *)&address, sizeof(address)) == -1 ||
+        listen(server_fd, 8) == -1) {
+        perror("bind");
+        close(server_fd);
+        server_fd = -1;
+        return 1;
+    }
+
+    if (pthread_create(&server_thread, NULL, serve_metrics, NULL) != 0) {
+        perror("pthread_create");
+        close(server_fd);
+        server_fd = -1;
+        unlink(path);
+        return 1;
+    }
+    return 0;
+}
+
+// Stops the server started by metrics_start_server, if any.
+void metrics_stop_server() {
+    if (server_fd == -1) {
+        return;
+    }
+    pthread_cancel(server_thread);
+    pthread_join(server_thread, NULL);
+    close(server_fd);
+    server_fd = -1;
+    unlink(server_path);
+}
@@ -0,0 +1,36 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+// Size of a cache line, every thread writes to its own line(s) so the
+// counters never bounce between cores.
+#define METRICS_CACHE_LINE 64
+// Max number of threads with a slot of their own. Extra threads share slots,
+// which is still correct but slower.
+#define METRICS_MAX_THREADS 16
+// Number of buckets for the loop latency, bucket i counts latencies below
+// 2^i microseconds, the last bucket counts everything else.
+#define METRICS_LATENCY_BUCKETS 24
+
+// The counters and gauges kept by the game.
+enum Metric {
+    METRIC_FRAMES_RENDERED,
+    METRIC_FRAMES_SKIPPED,
+    METRIC_TICKS,
+    METRIC_PIECES_SPAWNED,
+    METRIC_LINES_CLEARED,
+    METRIC_INPUT_EVENTS,
+    METRIC_INPUT_REPEATS,
+    METRIC_RENDER_BYTES,
+    // Gauge, number of games currently running.
+    METRIC_GAMES_RUNNING,
+    METRIC_LOOP_LATENCY_SUM,
+    METRIC_LOOP_LATENCY_COUNT,
+    METRIC_COUNT,
+};
+
+void metrics_add(enum Metric metric, long n);
+void metrics_observe_latency(long latency);
+int metrics_start_server(const char *path);
+void metrics_stop_server();
+
+#endif
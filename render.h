@@ -0,0 +1,32 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include "engine.h"
+
+// Number of lines rendered: the title, the top border, the grid, the bottom
+// border and the shape.
+#define RENDERED_HEIGHT (HEIGHT + 4)
+// Multiply by 2 because each 1 or block of the tetromino is two characters
+// long and plus 2 to make up for the left/right borders.
+#define RENDERED_WIDTH (WIDTH * 2 + 2)
+
+// A way of drawing the game on the terminal. The backend is picked at startup
+// and the main loop only talks to it through these functions.
+typedef struct {
+    const char *name;
+    // Sets the terminal up for drawing. Returns 0 on success.
+    int (*init)(GameState *game_state);
+    // Called after the window changed size and the center was recomputed.
+    void (*resize)(GameState *game_state);
+    // Draws the playfield. Returns the number of bytes written.
+    int (*draw)(GameState *game_state);
+    // Draws the game over screen. Returns the number of bytes written.
+    int (*draw_game_over)(GameState *game_state);
+    // Gives the terminal back.
+    void (*end)(GameState *game_state);
+} RenderBackend;
+
+extern RenderBackend ansi_backend;
+extern RenderBackend ncurses_backend;
+
+#endif
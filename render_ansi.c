@@ -0,0 +1,140 @@
+#include "render.h"
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CLEAR_SCREEN_AND_HIDE_CURSOR "\033[2J\033[?25l"
+#define SHOW_CURSOR "\033[?25h"
+// Every rendered line starts with a cursor move, this is room for it.
+#define CURSOR_MOVE_SIZE 16
+// Big enough for a whole frame, including the clear screen.
+#define FRAME_SIZE                                                             \
+    (RENDERED_HEIGHT * (RENDERED_WIDTH + CURSOR_MOVE_SIZE) + 32)
+
+// The frame being built and the last frame written to the terminal. When
+// nothing changed the frame is not written at all.
+static char frame[FRAME_SIZE];
+static int frame_length;
+static char last_frame[FRAME_SIZE];
+static int last_frame_length;
+// Cleared when the terminal content is unknown, like after a resize, so the
+// next frame clears the screen and is written in full.
+static int is_frame_valid;
+
+// Appends formatted text to the frame being built.
+static void append_to_frame(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(frame + frame_length, FRAME_SIZE - frame_length, format,
+                      args);
+    va_end(args);
+    if (n > 0) {
+        frame_length += n;
+        if (frame_length > FRAME_SIZE - 1) {
+            frame_length = FRAME_SIZE - 1;
+        }
+    }
+}
+
+// Moves the cursor to the given line of the rendered view.
+static void move_to_line(GameState *game_state, int line) {
+    // the escape sequence is 1-based.
+    append_to_frame("\033[%d;%dH", game_state->window_center_y + line + 1,
+                    game_state->window_center_x + 1);
+}
+
+// Writes the whole buffer to the terminal. Returns the number of bytes
+// written.
+static int write_all(const char *buffer, int length) {
+    int written = 0;
+    while (written < length) {
+        ssize_t n = write(STDOUT_FILENO, buffer + written, length - written);
+        if (n <= 0) {
+            break;
+        }
+        written += n;
+    }
+    return written;
+}
+
+static int ansi_init(GameState *game_state) {
+    (void)game_state;
+    is_frame_valid = 0;
+    return 0;
+}
+
+static void ansi_resize(GameState *game_state) {
+    (void)game_state;
+    is_frame_valid = 0;
+}
+
+// Builds the frame with one cursor move per line, then writes it in one go.
+static int ansi_draw(GameState *game_state) {
+    frame_length = 0;
+    if (!is_frame_valid) {
+        append_to_frame(CLEAR_SCREEN_AND_HIDE_CURSOR);
+    }
+
+    // print game title and score
+    move_to_line(game_state, 0);
+    append_to_frame("Tetris! Score: %7d", game_state->score);
+
+    // print the top border
+    move_to_line(game_state, 1);
+    for (int s = 0; s < RENDERED_WIDTH; s++) {
+        append_to_frame("-");
+    }
+
+    // print the grid
+    for (int y = 0; y < HEIGHT; y++) {
+        move_to_line(game_state, y + 2);
+        append_to_frame(":");
+        for (int x = 0; x < WIDTH; x++) {
+            if (game_state->virtual_grid[y][x] == 1) {
+                append_to_frame("[]");
+            } else {
+                append_to_frame("  ");
+            }
+        }
+        append_to_frame(":");
+    }
+
+    // print the bottom border
+    move_to_line(game_state, HEIGHT + 2);
+    for (int s = 0; s < RENDERED_WIDTH; s++) {
+        append_to_frame("-");
+    }
+    move_to_line(game_state, HEIGHT + 3);
+    append_to_frame("Shape: %c  Level: %2d",
+                    shape_names[game_state->current_shape], game_state->level);
+
+    if (is_frame_valid && frame_length == last_frame_length &&
+        memcmp(frame, last_frame, frame_length) == 0) {
+        return 0;
+    }
+    memcpy(last_frame, frame, frame_length);
+    last_frame_length = frame_length;
+    is_frame_valid = 1;
+    return write_all(frame, frame_length);
+}
+
+static int ansi_draw_game_over(GameState *game_state) {
+    frame_length = 0;
+    append_to_frame(CLEAR_SCREEN_AND_HIDE_CURSOR);
+    move_to_line(game_state, RENDERED_HEIGHT / 2);
+    append_to_frame("Game Over");
+    move_to_line(game_state, RENDERED_HEIGHT);
+    append_to_frame("\n");
+    is_frame_valid = 0;
+    return write_all(frame, frame_length);
+}
+
+static void ansi_end(GameState *game_state) {
+    (void)game_state;
+    write_all(SHOW_CURSOR, strlen(SHOW_CURSOR));
+}
+
+// Writes escape sequences straight to the terminal.
+RenderBackend ansi_backend = {
+    "ansi", ansi_init, ansi_resize, ansi_draw, ansi_draw_game_over, ansi_end,
+};
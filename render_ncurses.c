@@ -0,0 +1,96 @@
+#include "render.h"
+#include <ncurses.h>
+#include <stdio.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+// The screen ncurses draws on and the window holding the rendered view.
+static SCREEN *screen;
+static WINDOW *board;
+
+// Creates the board window at the center of the terminal.
+static void create_board(GameState *game_state) {
+    if (board != NULL) {
+        delwin(board);
+    }
+    board = newwin(RENDERED_HEIGHT, RENDERED_WIDTH, game_state->window_center_y,
+                   game_state->window_center_x);
+    leaveok(board, TRUE);
+}
+
+static int ncurses_init(GameState *game_state) {
+    screen = newterm(NULL, stdout, stdin);
+    if (screen == NULL) {
+        fprintf(stderr, "newterm: cannot initialize ncurses\n");
+        return 1;
+    }
+    noecho();
+    cbreak();
+    // the input thread reads stdin, ncurses must not cut a refresh short
+    // because a key is waiting there.
+    typeahead(-1);
+    curs_set(0);
+    create_board(game_state);
+    return 0;
+}
+
+static void ncurses_resize(GameState *game_state) {
+    struct winsize window;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &window) == 0) {
+        resizeterm(window.ws_row, window.ws_col);
+    }
+    // everything on screen is stale, only the board is drawn again.
+    clear();
+    wnoutrefresh(stdscr);
+    create_board(game_state);
+}
+
+// Draws into the board window and lets ncurses send only what changed.
+static int ncurses_draw(GameState *game_state) {
+    werase(board);
+    mvwprintw(board, 0, 0, "Tetris! Score: %7d", game_state->score);
+    mvwhline(board, 1, 0, '-', RENDERED_WIDTH);
+    for (int y = 0; y < HEIGHT; y++) {
+        wmove(board, y + 2, 0);
+        waddch(board, ':');
+        for (int x = 0; x < WIDTH; x++) {
+            waddstr(board, game_state->virtual_grid[y][x] == 1 ? "[]" : "  ");
+        }
+        waddch(board, ':');
+    }
+    mvwhline(board, HEIGHT + 2, 0, '-', RENDERED_WIDTH);
+    mvwprintw(board, HEIGHT + 3, 0, "Shape: %c  Level: %2d",
+              shape_names[game_state->current_shape], game_state->level);
+
+    wnoutrefresh(board);
+    doupdate();
+    // ncurses writes straight to the file descriptor, the bytes it sends are
+    // not counted.
+    return 0;
+}
+
+static int ncurses_draw_game_over(GameState *game_state) {
+    (void)game_state;
+    werase(board);
+    mvwaddstr(board, RENDERED_HEIGHT / 2, 0, "Game Over");
+    wnoutrefresh(board);
+    doupdate();
+    return 0;
+}
+
+static void ncurses_end(GameState *game_state) {
+    (void)game_state;
+    if (board != NULL) {
+        delwin(board);
+        board = NULL;
+    }
+    endwin();
+    delscreen(screen);
+    screen = NULL;
+}
+
+// Lets ncurses keep a copy of the screen and only send the differences.
+RenderBackend ncurses_backend = {
+    "ncurses",    ncurses_init,           ncurses_resize,
+    ncurses_draw, ncurses_draw_game_over, ncurses_end,
+};